@@ -127,6 +127,11 @@ void onEvent (ev_t ev) {
         case EV_LINK_ALIVE:
             Serial.println(F("EV_LINK_ALIVE"));
             break;
+        case EV_TXCANCELED:
+            Serial.println(F("EV_TXCANCELED (payload too long for the datarate)"));
+            // Schedule next transmission
+            os_setTimedCallback(&sendjob, os_getTime()+sec2osticks(TX_INTERVAL), do_send);
+            break;
          default:
             Serial.println(F("Unknown event"));
             break;
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Benchmark of the AES implementation selected at compile time. It times
+ * os_aes() in the AES_ENC, AES_CTR and AES_MIC modes, as well as the
+ * aes_appendMic(), aes_verifyMic() and aes_cipher() functions used by
+ * the MAC layer, for LoRaWAN-sized inputs of 16 to 64 bytes.
+ *
+ * lmic.c is included rather than linked, since those functions are
+ * static. The Makefile builds this once per AES implementation.
+ *
+ * Results are printed as CSV lines, one line per measurement. Each
+ * measurement is the fastest of ROUNDS runs of ITERATIONS operations.
+ * Cycles are read from the time stamp counter and are only reported on
+ * x86 hosts.
+ *******************************************************************************/
+
+#include "lmic.c"
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#if !defined(ITERATIONS)
+#define ITERATIONS 20000
+#endif
+#if !defined(ROUNDS)
+#define ROUNDS 5
+#endif
+
+#if defined(USE_ORIGINAL_AES)
+static const char backend[] = "original";
+#elif defined(USE_IDEETRON_AES) && defined(ENABLE_HAL_AES)
+static const char backend[] = "ideetron+hal";
+#elif defined(USE_IDEETRON_AES)
+static const char backend[] = "ideetron";
+#else
+static const char backend[] = "unknown";
+#endif
+
+// Arbitrary key and session parameters, the values do not influence
+// the timing.
+static const u1_t key[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                              0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u4_t devaddr = 0x26011234;
+static u4_t seqno;
+
+// Room for the largest payload plus the MIC
+static u1_t buf[64 + 4];
+
+// Results are accumulated here, so the work cannot be optimized away
+static volatile u4_t sink;
+
+static void rawAes (u1_t mode, u1_t len) {
+    os_clearMem(AESaux, 16);
+    os_copyMem(AESkey, key, 16);
+    sink += os_aes(mode, buf, len);
+}
+
+enum { OP_ENC, OP_CTR, OP_MIC, OP_APPENDMIC, OP_VERIFYMIC, OP_CIPHER, OP_COUNT };
+static const char* const opNames[OP_COUNT] = {
+    "enc", "ctr", "mic", "appendMic", "verifyMic", "cipher"
+};
+
+static void runOp (u1_t op, u1_t len) {
+    switch( op ) {
+    case OP_ENC:       rawAes(AES_ENC, len); break;
+    case OP_CTR:       rawAes(AES_CTR, len); break;
+    case OP_MIC:       rawAes(AES_MIC, len); break;
+    case OP_APPENDMIC: aes_appendMic(key, devaddr, seqno, 0, buf, len); break;
+    case OP_VERIFYMIC: sink += aes_verifyMic(key, devaddr, seqno, 1, buf, len); break;
+    case OP_CIPHER:    aes_cipher(key, devaddr, seqno, 0, buf, len); break;
+    }
+}
+
+static uint64_t nanos (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void measure (u1_t op, u1_t len) {
+    uint64_t bestNs = ~0ULL, bestCycles = ~0ULL;
+
+    for( u1_t r = 0; r < ROUNDS; r++ ) {
+        for( u1_t i = 0; i < len; i++ )
+            buf[i] = i;
+        uint64_t ns = nanos();
+#if defined(HAVE_CYCLES)
+        uint64_t cycles = __rdtsc();
+#endif
+        for( u4_t i = 0; i < ITERATIONS; i++ ) {
+            runOp(op, len);
+            seqno++;
+        }
+#if defined(HAVE_CYCLES)
+        cycles = __rdtsc() - cycles;
+        if( cycles < bestCycles )
+            bestCycles = cycles;
+#endif
+        ns = nanos() - ns;
+        if( ns < bestNs )
+            bestNs = ns;
+    }
+
+    double nsPerFrame = (double)bestNs / ITERATIONS;
+    printf("%s,%s,%u,%u,%.1f,%.2f", backend, opNames[op], len, ITERATIONS,
+           nsPerFrame, nsPerFrame / len);
+#if defined(HAVE_CYCLES)
+    double cyclesPerFrame = (double)bestCycles / ITERATIONS;
+    printf(",%.0f,%.1f\n", cyclesPerFrame, cyclesPerFrame / len);
+#else
+    printf(",,\n");
+#endif
+}
+
+int main (void) {
+    printf("backend,op,len,iterations,ns_per_frame,ns_per_byte,cycles_per_frame,cycles_per_byte\n");
+    for( u1_t op = 0; op < OP_COUNT; op++ ) {
+        // ENC works on whole blocks only
+        u1_t step = (op == OP_ENC) ? 16 : 8;
+        for( u1_t len = 16; len <= 64; len += step )
+            measure(op, len);
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Checks the AES implementation selected at compile time against
+ * OpenSSL: the MIC generation and verification, the payload encryption
+ * and the join accept decryption and session key derivation done by the
+ * MAC layer, for every frame length. With ENABLE_HAL_AES, this is linked
+ * with the AES-NI stand-in from hal-aesni.c, which declines every third
+ * block so both the hardware and the software paths are used.
+ *
+ * lmic.c is included rather than linked, since those functions are
+ * static. Exits with a non-zero status when any result differs.
+ *******************************************************************************/
+
+#include "lmic.c"
+#include <stdio.h>
+#include <openssl/evp.h>
+#include <openssl/core_names.h>
+
+#if defined(ENABLE_HAL_AES)
+extern unsigned hal_aes_decline, hal_aes_blocks, hal_aes_declined;
+#endif
+
+static const u1_t key[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                              0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u4_t devaddr = 0x26011234;
+
+static int failures;
+
+static void check (int ok, const char* what, int len) {
+    if( !ok ) {
+        printf("FAIL %s, length %d\n", what, len);
+        failures++;
+    }
+}
+
+static void refCipher (const EVP_CIPHER* cipher, int enc, const u1_t* k,
+                       const u1_t* iv, u1_t* buf, int len) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int outl;
+    EVP_CipherInit_ex(ctx, cipher, NULL, k, iv, enc);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_CipherUpdate(ctx, buf, &outl, buf, len);
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+static u4_t refCmac (const u1_t* k, const u1_t* msg, int len) {
+    EVP_MAC* mac = EVP_MAC_fetch(NULL, "CMAC", NULL);
+    EVP_MAC_CTX* ctx = EVP_MAC_CTX_new(mac);
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_CIPHER, "AES-128-CBC", 0),
+        OSSL_PARAM_construct_end()
+    };
+    u1_t out[16];
+    size_t outl;
+    EVP_MAC_init(ctx, k, 16, params);
+    EVP_MAC_update(ctx, msg, len);
+    EVP_MAC_final(ctx, out, &outl, sizeof(out));
+    EVP_MAC_CTX_free(ctx);
+    EVP_MAC_free(mac);
+    return os_rmsbf4(out);
+}
+
+// B0 or A1 block as defined by the LoRaWAN specification
+static void refBlock (u1_t* b, u1_t type, u4_t seqno, int dndir, u1_t last) {
+    os_clearMem(b, 16);
+    b[0] = type;
+    b[5] = dndir;
+    os_wlsbf4(b+6, devaddr);
+    os_wlsbf4(b+10, seqno);
+    b[15] = last;
+}
+
+static void testFrames (void) {
+    u1_t pdu[MAX_LEN_FRAME+4], ref[16+MAX_LEN_FRAME], iv[16];
+
+    for( int len = 1; len <= MAX_LEN_FRAME; len++ ) {
+        u4_t seqno = 0x10000 + len * 77;
+        int dndir = len & 1;
+        for( int i = 0; i < len; i++ )
+            pdu[i] = i * 13 + len;
+
+        refBlock(ref, 0x49, seqno, dndir, len);
+        os_copyMem(ref+16, pdu, len);
+        aes_appendMic(key, devaddr, seqno, dndir, pdu, len);
+        check(os_rmsbf4(pdu+len) == refCmac(key, ref, 16+len), "appendMic", len);
+        check(aes_verifyMic(key, devaddr, seqno, dndir, pdu, len), "verifyMic", len);
+        pdu[len] ^= 1;
+        check(!aes_verifyMic(key, devaddr, seqno, dndir, pdu, len), "verifyMic (bad MIC)", len);
+
+        os_copyMem(ref, pdu, len);
+        refBlock(iv, 0x01, seqno, dndir, 1);
+        refCipher(EVP_aes_128_ctr(), 1, key, iv, ref, len);
+        aes_cipher(key, devaddr, seqno, dndir, pdu, len);
+        check(memcmp(pdu, ref, len) == 0, "cipher", len);
+    }
+}
+
+static void testJoinAccept (void) {
+    // The device key from hal.c
+    u1_t devkey[16], pdu[LEN_JAEXT], ref[32];
+    os_getDevKey(devkey);
+
+    for( int len = LEN_JA; len <= LEN_JAEXT; len += LEN_JAEXT - LEN_JA ) {
+        u2_t devnonce = 0x1234 + len;
+        pdu[0] = HDR_FTYPE_JACC | HDR_MAJOR_V1;
+        for( int i = 1; i < len-4; i++ )
+            pdu[i] = i * 29 + len;
+        os_wmsbf4(pdu+len-4, refCmac(devkey, pdu, len-4));
+
+        // The network encrypts with an AES decryption
+        u1_t plain[LEN_JAEXT];
+        os_copyMem(plain, pdu, len);
+        refCipher(EVP_aes_128_ecb(), 0, devkey, NULL, pdu+1, len-1);
+
+        u1_t sesskeys[32];
+        check(aes_joinAccept(pdu, len, devnonce, sesskeys), "joinAccept MIC", len);
+        check(memcmp(pdu, plain, len) == 0, "joinAccept decryption", len);
+
+        os_clearMem(ref, 32);
+        ref[0] = 0x01;
+        os_copyMem(ref+1, plain+OFF_JA_ARTNONCE, LEN_ARTNONCE+LEN_NETID);
+        os_wlsbf2(ref+1+LEN_ARTNONCE+LEN_NETID, devnonce);
+        os_copyMem(ref+16, ref, 16);
+        ref[16] = 0x02;
+        refCipher(EVP_aes_128_ecb(), 1, devkey, NULL, ref, 32);
+        check(memcmp(sesskeys, ref, 32) == 0, "joinAccept session keys", len);
+    }
+}
+
+int main (void) {
+#if defined(ENABLE_HAL_AES)
+    hal_aes_decline = 3;
+#endif
+    testFrames();
+    testJoinAccept();
+#if defined(ENABLE_HAL_AES)
+    printf("hal_aes_encrypt: %u blocks encrypted, %u declined\n",
+           hal_aes_blocks, hal_aes_declined);
+    check(hal_aes_blocks != 0 && hal_aes_declined != 0, "hal_aes_encrypt use", 0);
+#endif
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures != 0;
+}
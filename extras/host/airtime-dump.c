@@ -0,0 +1,28 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Prints calcAirTime() for every spreading factor, bandwidth, coding
+ * rate, header and CRC setting and every frame length. The Makefile
+ * builds this with and without ENABLE_AIRTIME_TABLE and compares the
+ * output, to check that the table matches the formula exactly.
+ *******************************************************************************/
+
+#include "lmic.h"
+#include <stdio.h>
+
+int main (void) {
+    for( int sf = FSK; sf <= SF12; sf++ )
+    for( int bw = BW125; bw <= BW500; bw++ )
+    for( int cr = CR_4_5; cr <= CR_4_8; cr++ )
+    for( int ih = 0; ih <= 20; ih += 20 )
+    for( int nocrc = 0; nocrc <= 1; nocrc++ ) {
+        rps_t rps = makeRps((sf_t)sf, (bw_t)bw, (cr_t)cr, ih, nocrc);
+        for( int len = 0; len <= 255; len++ )
+            printf("%04x %3d %ld\n", rps, len, (long)calcAirTime(rps, len));
+    }
+    return 0;
+}
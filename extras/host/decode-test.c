@@ -0,0 +1,125 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Checks LMIC_decodeFrames() (ENABLE_BATCH_CRYPTO) against frames built
+ * with the same encryption and MIC functions the device uses to send:
+ * valid frames are accepted and decrypted with the right key, frames
+ * with a tampered MIC or payload are rejected and left untouched, and
+ * malformed frames are reported as such.
+ *
+ * lmic.c is included rather than linked, since those functions are
+ * static. Exits with a non-zero status when any result differs.
+ *******************************************************************************/
+
+#include "lmic.c"
+#include <stdio.h>
+
+static const u1_t nwkKey[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                                 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u1_t artKey[16] = { 0x60, 0x3D, 0xEB, 0x10, 0x15, 0xCA, 0x71, 0xBE,
+                                 0x2B, 0x73, 0xAE, 0xF0, 0x85, 0x7D, 0x77, 0x81 };
+static const u4_t devaddr = 0x26011234;
+
+enum { NFRAMES = 9 };
+static u1_t pdus[NFRAMES][MAX_LEN_FRAME];
+static u1_t plain[NFRAMES][MAX_LEN_PAYLOAD];
+static batchframe_t frames[NFRAMES];
+
+static int failures;
+
+static void check (int ok, const char* what, int frame) {
+    if( !ok ) {
+        printf("FAIL %s, frame %d\n", what, frame);
+        failures++;
+    }
+}
+
+// Build a data frame the way buildDataFrame() does: header, options,
+// port and payload encrypted with the key for that port, then the MIC.
+// A negative port builds a frame without port and payload.
+static void buildFrame (int i, u1_t ftype, u4_t seqno, u1_t optlen, int port, u1_t dlen) {
+    u1_t* d = pdus[i];
+    int dndir = (ftype & HDR_FTYPE_DNFLAG) != 0;
+    d[OFF_DAT_HDR] = ftype | HDR_MAJOR_V1;
+    os_wlsbf4(d+OFF_DAT_ADDR, devaddr);
+    d[OFF_DAT_FCT] = optlen;
+    os_wlsbf2(d+OFF_DAT_SEQNO, seqno);
+    int end = OFF_DAT_OPTS;
+    for( int k = 0; k < optlen; k++ )
+        d[end++] = 0x02;             // LinkCheckReq, or the answer
+    if( port >= 0 ) {
+        d[end++] = port;
+        for( int k = 0; k < dlen; k++ )
+            plain[i][k] = d[end+k] = k * 7 + i;
+        aes_cipher(port == 0 ? nwkKey : artKey, devaddr, seqno, dndir, d+end, dlen);
+        end += dlen;
+    }
+    aes_appendMic(nwkKey, devaddr, seqno, dndir, d, end);
+
+    frames[i].nwkKey = nwkKey;
+    frames[i].artKey = artKey;
+    frames[i].seqno  = seqno;
+    frames[i].pdu    = d;
+    frames[i].len    = end+4;
+}
+
+static void checkPayload (int i, int dataBeg, int dataLen) {
+    check(frames[i].result == BATCH_OK, "result", i);
+    check(frames[i].dataBeg == dataBeg && frames[i].dataLen == dataLen, "payload position", i);
+    check(memcmp(frames[i].pdu+dataBeg, plain[i], dataLen) == 0, "payload decryption", i);
+}
+
+int main (void) {
+    // 0: uplink on an application port
+    buildFrame(0, HDR_FTYPE_DAUP, 0x10001, 0, 1, 10);
+    // 1: confirmed downlink with options, high frame counter bits
+    buildFrame(1, HDR_FTYPE_DCDN, 0x5ABCD, 2, 200, MAX_LEN_PAYLOAD-3);
+    // 2: MAC commands on port 0, encrypted with the network key
+    buildFrame(2, HDR_FTYPE_DADN, 7, 0, 0, 5);
+    // 3: no port and no payload
+    buildFrame(3, HDR_FTYPE_DAUP, 8, 1, -1, 0);
+    // 4: tampered MIC
+    buildFrame(4, HDR_FTYPE_DAUP, 9, 0, 2, 12);
+    pdus[4][frames[4].len-1] ^= 0x80;
+    // 5: tampered payload
+    buildFrame(5, HDR_FTYPE_DCUP, 10, 0, 3, 12);
+    pdus[5][OFF_DAT_OPTS+1] ^= 0x01;
+    // 6: frame counter does not match the low bits of seqno
+    buildFrame(6, HDR_FTYPE_DAUP, 11, 0, 4, 4);
+    frames[6].seqno = 12;
+    // 7: too short to be a data frame
+    buildFrame(7, HDR_FTYPE_DAUP, 13, 0, -1, 0);
+    frames[7].len = OFF_DAT_OPTS+3;
+    // 8: not a data frame
+    buildFrame(8, HDR_FTYPE_DAUP, 14, 0, 5, 4);
+    pdus[8][OFF_DAT_HDR] = HDR_FTYPE_JREQ | HDR_MAJOR_V1;
+
+    u1_t before[NFRAMES][MAX_LEN_FRAME];
+    memcpy(before, pdus, sizeof(pdus));
+
+    check(LMIC_decodeFrames(frames, NFRAMES) == 4, "number of valid frames", -1);
+
+    checkPayload(0, OFF_DAT_OPTS+1, 10);
+    checkPayload(1, OFF_DAT_OPTS+2+1, MAX_LEN_PAYLOAD-3);
+    check(pdus[1][OFF_DAT_OPTS+2] == 200, "port", 1);
+    checkPayload(2, OFF_DAT_OPTS+1, 5);
+    check(frames[3].result == BATCH_OK && frames[3].dataBeg == 0 && frames[3].dataLen == 0,
+          "frame without payload", 3);
+
+    check(frames[4].result == BATCH_BADMIC, "tampered MIC", 4);
+    check(frames[5].result == BATCH_BADMIC, "tampered payload", 5);
+    check(frames[6].result == BATCH_INVALID, "frame counter mismatch", 6);
+    check(frames[7].result == BATCH_INVALID, "short frame", 7);
+    check(frames[8].result == BATCH_INVALID, "join request", 8);
+    for( int i = 4; i < NFRAMES; i++ ) {
+        check(frames[i].dataBeg == 0 && frames[i].dataLen == 0, "payload of rejected frame", i);
+        check(memcmp(pdus[i], before[i], frames[i].len) == 0, "rejected frame modified", i);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures != 0;
+}
@@ -0,0 +1,52 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Stand-in for an AES peripheral, see ENABLE_HAL_AES in config.h. It
+ * implements hal_aes_encrypt() with the x86 AES-NI instructions, the
+ * same way hardware with a single block encryption engine would be used.
+ *******************************************************************************/
+
+#include "lmic.h"
+#include <wmmintrin.h>
+
+// When not zero, every hal_aes_decline-th block is declined, so it is
+// encrypted by the software implementation instead.
+unsigned hal_aes_decline;
+// Number of blocks encrypted and declined by hal_aes_encrypt()
+unsigned hal_aes_blocks, hal_aes_declined;
+
+static __m128i expandKey (__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+#define EXPAND(i, rcon) \
+    rk[i] = expandKey(rk[i-1], _mm_aeskeygenassist_si128(rk[i-1], rcon))
+
+u1_t hal_aes_encrypt (u1_t* data, const u1_t* key) {
+    if( hal_aes_decline && (hal_aes_blocks + hal_aes_declined + 1) % hal_aes_decline == 0 ) {
+        hal_aes_declined++;
+        return 0;
+    }
+    hal_aes_blocks++;
+
+    __m128i rk[11];
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    EXPAND(1, 0x01); EXPAND(2, 0x02); EXPAND(3, 0x04); EXPAND(4, 0x08);
+    EXPAND(5, 0x10); EXPAND(6, 0x20); EXPAND(7, 0x40); EXPAND(8, 0x80);
+    EXPAND(9, 0x1b); EXPAND(10, 0x36);
+
+    __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), rk[0]);
+    for( u1_t i = 1; i < 10; i++ )
+        block = _mm_aesenc_si128(block, rk[i]);
+    block = _mm_aesenclast_si128(block, rk[10]);
+    _mm_storeu_si128((__m128i*)data, block);
+    return 1;
+}
@@ -0,0 +1,77 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Minimal HAL for the host programs in this directory. There is no
+ * radio, so the pins and SPI do nothing; time comes from the host clock.
+ *******************************************************************************/
+
+#include "lmic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+void hal_init (void) {
+}
+
+void hal_pin_nss (u1_t val) {
+}
+
+void hal_pin_rxtx (u1_t val) {
+}
+
+void hal_pin_rst (u1_t val) {
+}
+
+u1_t hal_spi (u1_t outval) {
+    return 0;
+}
+
+void hal_disableIRQs (void) {
+}
+
+void hal_enableIRQs (void) {
+}
+
+void hal_sleep (void) {
+}
+
+u4_t hal_ticks (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u4_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000) >> US_PER_OSTICK_EXPONENT;
+}
+
+void hal_waitUntil (u4_t time) {
+    while( (s4_t)(time - hal_ticks()) > 0 )
+        ;
+}
+
+u1_t hal_checkTimer (u4_t targettime) {
+    return (s4_t)(targettime - hal_ticks()) <= 0;
+}
+
+void hal_failed (const char *file, u2_t line) {
+    fprintf(stderr, "FAILURE %s:%u\n", file, line);
+    abort();
+}
+
+// These callbacks are only used in over-the-air activation, the host
+// programs do not join.
+void os_getArtEui (u1_t* buf) {
+    os_clearMem(buf, 8);
+}
+
+void os_getDevEui (u1_t* buf) {
+    os_clearMem(buf, 8);
+}
+
+void os_getDevKey (u1_t* buf) {
+    os_clearMem(buf, 16);
+}
+
+void onEvent (ev_t ev) {
+}
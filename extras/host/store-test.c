@@ -0,0 +1,123 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Checks the session store (ENABLE_SESSION_STORE with LMIC_STORE_FILE and
+ * ENABLE_JOIN_STRATEGY) across reboots. Every run is one boot; the
+ * Makefile runs this several times on the same storage file:
+ *
+ *   store-test session N   N-th boot with a session. Without a stored
+ *                          session (N = 0), one is set up, otherwise it
+ *                          is restored with LMIC_restoreSession() and
+ *                          checked. Then the frame counters are updated
+ *                          more often than the journal has entries.
+ *   store-test join N      N-th boot while joining. The join nonce and
+ *                          datarate stored before are checked (N > 0),
+ *                          then more join attempts than the journal has
+ *                          entries are stored.
+ *
+ * Exits with a non-zero status when anything read back differs.
+ *******************************************************************************/
+
+#include "lmic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(LMIC_STORE_JOURNAL)
+#define LMIC_STORE_JOURNAL 32
+#endif
+
+// Counter updates per session boot and join attempts per join boot
+enum { UPDATES = LMIC_STORE_JOURNAL + 5, JOINS = LMIC_STORE_JOURNAL + 3 };
+enum { NONCE_BASE = 1000 };
+
+static const u4_t netid = 0x13, devaddr = 0x26011234;
+static const u1_t nwkKey[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                                 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u1_t artKey[16] = { 0x60, 0x3D, 0xEB, 0x10, 0x15, 0xCA, 0x71, 0xBE,
+                                 0x2B, 0x73, 0xAE, 0xF0, 0x85, 0x7D, 0x77, 0x81 };
+
+// There is no radio, so this is linked instead of radio.c. The MAC layer
+// only uses it for random numbers here, their value does not matter.
+void radio_init (void) {
+}
+
+void os_radio (u1_t mode) {
+}
+
+u1_t radio_rand1 (void) {
+    return rand();
+}
+
+static int failures;
+
+static void check (int ok, const char* what) {
+    if( !ok ) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+static void session (int boot) {
+    if( boot == 0 ) {
+        check(!LMIC_restoreSession(), "no session stored yet");
+        LMIC_setSession(netid, devaddr, (xref2u1_t)nwkKey, (xref2u1_t)artKey);
+        LMIC_setDrTxpow(DR_SF8, 14);
+#if defined(CFG_eu868)
+        LMIC_setupChannel(3, 867100000, DR_RANGE_MAP(DR_SF12, DR_SF7), BAND_CENTI);
+#endif
+    } else {
+        check(LMIC_restoreSession(), "session restored");
+        check(LMIC.netid == netid && LMIC.devaddr == devaddr, "address");
+        check(memcmp(LMIC.nwkKey, nwkKey, 16) == 0 && memcmp(LMIC.artKey, artKey, 16) == 0,
+              "session keys");
+        check(LMIC.datarate == DR_SF8, "datarate");
+#if defined(CFG_eu868)
+        check((LMIC.channelFreq[3] & ~(u4_t)3) == 867100000 && (LMIC.channelMap & (1 << 3)) != 0,
+              "channel plan");
+#endif
+        check(LMIC.seqnoUp == (u4_t)boot * UPDATES, "uplink frame counter");
+        check(LMIC.seqnoDn == (u4_t)boot * 2, "downlink frame counter");
+    }
+    // The way the MAC layer reports counter updates
+    for( int i = 0; i < UPDATES; i++ ) {
+        LMIC.seqnoUp += 1;
+        DO_DEVDB(LMIC.seqnoUp, seqnoUp);
+        if( i == 0 || i == UPDATES-1 ) {
+            LMIC.seqnoDn += 1;
+            DO_DEVDB(LMIC.seqnoDn, seqnoDn);
+        }
+    }
+}
+
+static void join (int boot) {
+    u2_t nonce;
+    u1_t dr;
+    store_loadJoin(&nonce, &dr);
+    if( boot > 0 ) {
+        check(nonce == NONCE_BASE + boot * JOINS, "join nonce");
+        check(dr == DR_SF9, "join datarate");
+    }
+    for( int i = 1; i <= JOINS; i++ )
+        store_join(NONCE_BASE + boot * JOINS + i, DR_SF9);
+}
+
+int main (int argc, char** argv) {
+    if( argc != 3 ) {
+        fprintf(stderr, "usage: %s session|join boot\n", argv[0]);
+        return 2;
+    }
+    int boot = atoi(argv[2]);
+    os_init();
+    LMIC_reset();
+    if( strcmp(argv[1], "session") == 0 )
+        session(boot);
+    else
+        join(boot);
+    printf("%s %d: %s\n", argv[1], boot, failures ? "FAILED" : "OK");
+    return failures != 0;
+}
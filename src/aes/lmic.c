@@ -207,13 +207,31 @@ u4_t AESKEY[11*16/sizeof(u4_t)];
 
 // generate 1+10 roundkeys for encryption with 128-bit key
 // read 128-bit key from AESKEY in MSBF, generate roundkey words in place
+// Raw key of the last key expansion. When os_aes is called again with
+// the same key (e.g. during a join, or MIC and encryption with the same
+// session key), the round keys in AESKEY[4..43] are still valid and
+// only the first four words have to be converted again.
+static u4_t lastkey[4];
+static u1_t lastkeyValid;
+
 static void aesroundkeys () {
     int i;
     u4_t b;
 
+    if( lastkeyValid &&
+        AESKEY[0] == lastkey[0] && AESKEY[1] == lastkey[1] &&
+        AESKEY[2] == lastkey[2] && AESKEY[3] == lastkey[3] ) {
+        for( i=0; i<4; i++) {
+            AESKEY[i] = swapmsbf(AESKEY[i]);
+        }
+        return;
+    }
+
     for( i=0; i<4; i++) {
+        lastkey[i] = AESKEY[i];
         AESKEY[i] = swapmsbf(AESKEY[i]);
     }
+    lastkeyValid = 1;
 
     b = AESKEY[3];
     for( ; i<44; i++ ) {
@@ -242,7 +260,7 @@ u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
             AESAUX[3] = swapmsbf(AESAUX[3]);
         }
 
-        while( (signed char)len > 0 ) {
+        while( (s2_t)len > 0 ) {
             u4_t a0, a1, a2, a3;
             u4_t t0, t1, t2, t3;
             u4_t *ki, *ke;
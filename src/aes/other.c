@@ -25,6 +25,10 @@
  *
  *  That takes a single 16-byte buffer and encrypts it wit the given
  *  16-byte key.
+ *
+ *  When ENABLE_HAL_AES is set, every block is offered to
+ *  hal_aes_encrypt() first, and lmic_aes_encrypt() is only used for
+ *  blocks the HAL does not encrypt.
  */
 
 #include "../lmic/oslmic.h"
@@ -38,6 +42,16 @@ void lmic_aes_encrypt(u1_t *data, u1_t *key);
 u4_t AESAUX[16/sizeof(u4_t)];
 u4_t AESKEY[11*16/sizeof(u4_t)];
 
+// Encrypt a single block, using the HAL AES hardware if enabled and
+// available for it.
+static void aes_encrypt_block(u1_t *data, u1_t *key) {
+#if defined(ENABLE_HAL_AES)
+    if (hal_aes_encrypt(data, key))
+        return;
+#endif
+    lmic_aes_encrypt(data, key);
+}
+
 // Shift the given buffer left one bit
 static void shift_left(xref2u1_t buf, u1_t len) {
     while (len--) {
@@ -55,7 +69,7 @@ static void shift_left(xref2u1_t buf, u1_t len) {
 // in any case. The CMAC result is returned in AESAUX as well.
 static void os_aes_cmac(xref2u1_t buf, u2_t len, u1_t prepend_aux) {
     if (prepend_aux)
-        lmic_aes_encrypt(AESaux, AESkey);
+        aes_encrypt_block(AESaux, AESkey);
     else
         memset (AESaux, 0, 16);
 
@@ -79,7 +93,7 @@ static void os_aes_cmac(xref2u1_t buf, u2_t len, u1_t prepend_aux) {
             // shifts and xor on that.
             u1_t final_key[16];
             memset(final_key, 0, sizeof(final_key));
-            lmic_aes_encrypt(final_key, AESkey);
+            aes_encrypt_block(final_key, AESkey);
 
             // Calculate K1
             u1_t msb = final_key[0] & 0x80;
@@ -100,7 +114,7 @@ static void os_aes_cmac(xref2u1_t buf, u2_t len, u1_t prepend_aux) {
                 AESaux[i] ^= final_key[i];
         }
 
-        lmic_aes_encrypt(AESaux, AESkey);
+        aes_encrypt_block(AESaux, AESkey);
     }
 }
 
@@ -112,7 +126,7 @@ static void os_aes_ctr (xref2u1_t buf, u2_t len) {
     while (len) {
         // Encrypt the counter block with the selected key
         memcpy(ctr, AESaux, sizeof(ctr));
-        lmic_aes_encrypt(ctr, AESkey);
+        aes_encrypt_block(ctr, AESkey);
 
         // Xor the payload with the resulting ciphertext
         for (u1_t i = 0; i < 16 && len > 0; i++, len--, buf++)
@@ -131,8 +145,8 @@ u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
 
         case AES_ENC:
             // TODO: Check / handle when len is not a multiple of 16
-            for (u1_t i = 0; i < len; i += 16)
-                lmic_aes_encrypt(buf+i, AESkey);
+            for (u2_t i = 0; i < len; i += 16)
+                aes_encrypt_block(buf+i, AESkey);
             break;
 
         case AES_CTR:
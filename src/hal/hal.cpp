@@ -251,6 +251,37 @@ void hal_init () {
 #endif
 }
 
+#if defined(ENABLE_HAL_AES)
+// Default without AES hardware, always use the software implementation.
+// Define this function in the sketch or a board support library to
+// use an AES peripheral instead.
+__attribute__((weak)) u1_t hal_aes_encrypt (u1_t* data, const u1_t* key) {
+    return 0;
+}
+#endif // defined(ENABLE_HAL_AES)
+
+#if defined(ENABLE_SESSION_STORE)
+#if defined(__AVR__)
+#include <avr/eeprom.h>
+#endif
+// Default session storage in the EEPROM of AVR boards. On other boards
+// nothing is stored, unless these functions are defined in the sketch or
+// a board support library.
+__attribute__((weak)) void hal_store_read (u2_t addr, u1_t* buf, u2_t len) {
+#if defined(__AVR__)
+    eeprom_read_block(buf, (const void*)addr, len);
+#else
+    memset(buf, 0xFF, len);
+#endif
+}
+
+__attribute__((weak)) void hal_store_write (u2_t addr, const u1_t* buf, u2_t len) {
+#if defined(__AVR__)
+    eeprom_update_block(buf, (void*)addr, len);
+#endif
+}
+#endif // defined(ENABLE_SESSION_STORE)
+
 void hal_failed (const char *file, u2_t line) {
 #if defined(LMIC_FAILURE_TO)
     LMIC_FAILURE_TO.println("FAILURE ");
@@ -0,0 +1,47 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Session storage in a file, for running LMIC on a host system, see
+ * LMIC_STORE_FILE in config.h.
+ *******************************************************************************/
+
+#include "../lmic/lmic.h"
+
+#if defined(ENABLE_SESSION_STORE) && defined(LMIC_STORE_FILE)
+#include <stdio.h>
+
+static FILE* storeFile (void) {
+    static FILE* f;
+    if( f == NULL ) {
+        f = fopen(LMIC_STORE_FILE, "r+b");
+        if( f == NULL )
+            f = fopen(LMIC_STORE_FILE, "w+b");
+        ASSERT(f != NULL);
+    }
+    return f;
+}
+
+void hal_store_read (u2_t addr, u1_t* buf, u2_t len) {
+    FILE* f = storeFile();
+    size_t n = 0;
+    if( fseek(f, addr, SEEK_SET) == 0 )
+        n = fread(buf, 1, len, f);
+    // Beyond the end of the file, the storage reads as erased
+    memset(buf+n, 0xFF, len-n);
+}
+
+void hal_store_write (u2_t addr, const u1_t* buf, u2_t len) {
+    FILE* f = storeFile();
+    fseek(f, 0, SEEK_END);
+    for( long end = ftell(f); end < addr; end++ )
+        fputc(0xFF, f);
+    fseek(f, addr, SEEK_SET);
+    fwrite(buf, 1, len, f);
+    fflush(f);
+}
+
+#endif // ENABLE_SESSION_STORE && LMIC_STORE_FILE
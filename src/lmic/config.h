@@ -20,6 +20,13 @@
 #define US_PER_OSTICK (1 << US_PER_OSTICK_EXPONENT)
 #define OSTICKS_PER_SEC (1000000 / US_PER_OSTICK)
 
+// Size of the frame buffer, which limits the size of frames that can be
+// sent and received. The LoRaWAN regional limits allow up to 255 bytes
+// (242 bytes of application payload) at the faster datarates, but every
+// byte here costs RAM, roughly twice when the uplink queue or keystream
+// options are enabled. Must be between 64 and 255.
+//#define LMIC_MAX_FRAME_LENGTH 64
+
 // Set this to 1 to enable some basic debug output (using printf) about
 // RF settings used during transmission and reception. Set to 2 to
 // enable more verbose output. Make sure that printf is actually
@@ -54,6 +61,159 @@
 //#define DISABLE_MCMD_PING_SET // set ping freq, automatically disabled by DISABLE_PING
 //#define DISABLE_MCMD_BCNI_ANS // next beacon start, automatical disabled by DISABLE_BEACON
 
+// Uncomment this to precompute the payload encryption keystream for the
+// next uplink after each transmission, so that encrypting the payload
+// when the application queues data is reduced to a simple XOR. This
+// lowers the latency between LMIC_setTxData2() and the start of the
+// transmission, at the cost of MAX_LEN_PAYLOAD bytes of RAM.
+//#define ENABLE_TX_KEYSTREAM
+
+// Uncomment this to include LMIC_decodeFrames(), which verifies and
+// decrypts batches of captured data frames using the same code as the
+// MAC layer. This is intended for host side tools like simulators and
+// is not needed on a device.
+//#define ENABLE_BATCH_CRYPTO
+
+// Uncomment this to enable a queue of uplink messages, filled with
+// LMIC_queueTxData(). Queued messages are sent highest priority first,
+// and in order within a priority, as soon as the duty cycle allows.
+// Every queue entry takes about MAX_LEN_PAYLOAD bytes of RAM.
+//#define ENABLE_TX_QUEUE
+// Number of messages the uplink queue can hold
+//#define LMIC_TX_QUEUE_SIZE 4
+// Uncomment this to combine queued messages for the same port into a
+// single frame, as far as the current datarate allows. Messages are
+// combined using a framing function set with LMIC_setTxFramer(), so the
+// receiver can split them again. Requires ENABLE_TX_QUEUE.
+//#define ENABLE_TX_AGGREGATE
+
+// Uncomment this to allow the application to write its payload directly
+// into the frame buffer using LMIC_getTxBuffer() and
+// LMIC_commitTxBuffer(), instead of copying it with LMIC_setTxData2().
+//#define ENABLE_TX_INPLACE
+
+// Uncomment this to allow registering handler functions for ranges of
+// downlink ports with LMIC_registerRxHandler(). Received payloads are
+// passed to the matching handler directly from the frame buffer, before
+// the event for the reception is reported.
+//#define ENABLE_RX_HANDLERS
+// Number of handlers that can be registered
+//#define LMIC_RX_HANDLERS 4
+
+// Uncomment this to post events to a queue instead of calling onEvent()
+// from within the MAC processing. The application then takes events
+// from the queue with LMIC_getEvent(), e.g. in its loop() function.
+// Every queue entry takes about MAX_LEN_PAYLOAD bytes of RAM, since it
+// keeps a copy of the received payload.
+//#define ENABLE_EVENT_QUEUE
+// Number of events the queue can hold
+//#define LMIC_EVENT_QUEUE_SIZE 8
+
+// Uncomment this to look up frame airtimes in a table generated at
+// compile time instead of computing them on every transmission. This
+// costs one 4-byte entry per data rate and frame length up to
+// LMIC_MAX_FRAME_LENGTH in flash (about 2.5k with the defaults).
+//#define ENABLE_AIRTIME_TABLE
+
+// Uncomment this to limit the total airtime within a sliding window
+// (e.g. a fair use policy of 30 s per 24 h), as configured with
+// LMIC_setAirtimeBudget().
+//#define ENABLE_AIRTIME_BUDGET
+// Number of buckets the window is divided into
+//#define LMIC_BUDGET_BUCKETS 12
+
+// Uncomment this to keep the session (keys, frame counters, channel
+// plan) in non-volatile storage, accessed through hal_store_read() and
+// hal_store_write(), so it can be restored after a reboot with
+// LMIC_restoreSession() instead of joining again. Frame counter updates
+// are appended to a journal instead of rewriting the whole session.
+// By default, the EEPROM of AVR boards is used.
+//#define ENABLE_SESSION_STORE
+// Offset of the store in the storage, and number of 4-byte journal
+// entries. The store takes two session snapshots of about 180 bytes plus
+// the journal.
+//#define LMIC_STORE_BASE 0
+//#define LMIC_STORE_JOURNAL 32
+// On a host system, keep the storage in this file instead
+//#define LMIC_STORE_FILE "lmic-session.bin"
+
+// Uncomment this to let the device choose its own data rate and TX power
+// while ADR is disabled, e.g. on mobile nodes. The strength of received
+// downlinks and the margins reported in link check answers are tracked,
+// and the fastest data rate and lowest power that keep the margin given
+// to LMIC_setLinkAdapt() are used.
+//#define ENABLE_LINK_ADAPT
+// Number of link measurements considered
+//#define LMIC_LINK_WINDOW 8
+// Lowest TX power to use, in dBm
+//#define LMIC_LINK_MINPOW 2
+// TX power of the gateways in dBm, used to estimate the uplink level from
+// the downlink level. Defaults to the highest power allowed (27 for
+// EU868 RX2, 30 for US915), which errs on the side of a lower estimate.
+//#define LMIC_LINK_GWPOW 27
+
+// Uncomment this to keep link statistics per channel (frames sent and
+// answered, average RSSI and SNR of the answers), see
+// LMIC_getChannelStats(). A channel on which several confirmed frames in
+// a row went unanswered, e.g. due to a narrowband interferer, is avoided
+// for a while, as long as enough other channels remain to hop over.
+//#define ENABLE_CHANNEL_STATS
+// Number of unanswered confirmed frames in a row to avoid a channel
+//#define LMIC_CHNL_FAILS 3
+// Time in seconds a failing channel is avoided
+//#define LMIC_CHNL_PENALTY 600
+// Minimum number of channels left to hop over
+//#define LMIC_CHNL_MIN 2
+
+// Uncomment this to support class C operation, see LMIC_setClassC().
+// The radio then listens on the RX2 frequency and datarate whenever no
+// TX/RX transaction is in progress, which gives a low downlink latency
+// at the cost of a receiver that is always on.
+//#define ENABLE_CLASS_C
+
+// Uncomment this to receive frames sent to multicast groups, which are set
+// up with LMIC_setMulticast(). Group frames are accepted during class C
+// reception and in class B ping slots, including ping slots of the groups
+// themselves, and are flagged with TXRX_MCAST.
+//#define ENABLE_MULTICAST
+// Number of multicast groups
+//#define LMIC_MCAST_GROUPS 2
+
+// Uncomment this to size the beacon RX windows from a drift model. A
+// line is fitted through the arrival times of the last LMIC_DRIFT_WINDOW
+// beacons, and the window is centered on the predicted arrival of the
+// next beacon and sized from the prediction error, which grows with
+// each missed beacon. With a stable clock, this gives shorter windows
+// than the default estimate from the largest drift change seen.
+//#define ENABLE_DRIFT_MODEL
+// Number of beacons in the model
+//#define LMIC_DRIFT_WINDOW 8
+// Additional uncertainty in microseconds per beacon period predicted,
+// for drift changes the model has not seen, e.g. due to temperature
+//#define LMIC_DRIFT_WANDER_us 60
+
+// Uncomment this to add LMIC_enableTrackingAt(), which starts beacon
+// tracking from an estimate of the GPS time, e.g. from an RTC or from
+// the last beacon tracked. The receiver is then only turned on when a
+// beacon can arrive, on the channel of that beacon, instead of for a
+// full beacon period on a single channel.
+//#define ENABLE_TIMED_SCAN
+
+// Uncomment this to control the join procedure with a join strategy (see
+// LMIC_setJoinStrategy()), which starts at the datarate of the last
+// successful join. The delay between join attempts grows exponentially
+// and is randomized, and the total join airtime is limited per hour (see
+// LMIC_setJoinAirtime()), so many devices powered up at once do not keep
+// joining at the same time. With ENABLE_SESSION_STORE, devNonce is an
+// incrementing counter kept in the store.
+//#define ENABLE_JOIN_STRATEGY
+// Random delay before the first join attempt in seconds, doubled with
+// each further attempt up to the maximum
+//#define LMIC_JOIN_BACKOFF_sec 8
+//#define LMIC_JOIN_BACKOFF_MAX_sec 3600
+// Default limit of join airtime per hour in milliseconds (1%)
+//#define LMIC_JOIN_AIRTIME_ms 36000
+
 // In LoRaWAN, a gateway applies I/Q inversion on TX, and nodes do the
 // same on RX. This ensures that gateways can talk to nodes and vice
 // versa, but gateways will not hear other gateways and nodes will not
@@ -78,6 +238,17 @@
 // own LoRaWAN library. It also uses lookup tables, but smaller
 // byte-oriented ones, making it use a lot less flash space (but it is
 // also about twice as slow as the original).
+// The selection can also be made from the compiler command line, e.g.
+// -DUSE_ORIGINAL_AES, which replaces this default.
+#if !defined(USE_ORIGINAL_AES) && !defined(USE_IDEETRON_AES)
 #define USE_IDEETRON_AES
+#endif
+//
+// Uncomment this to let the AES code above offer every block encryption
+// to hal_aes_encrypt() first, so a hardware AES peripheral can be used
+// when available. When the HAL declines a block, the software
+// implementation is used instead. This cannot be combined with
+// USE_ORIGINAL_AES, which does not use separate block encryptions.
+//#define ENABLE_HAL_AES
 
 #endif // _lmic_config_h_
@@ -84,6 +84,29 @@ u1_t hal_checkTimer (u4_t targettime);
  */
 void hal_failed (const char *file, u2_t line);
 
+#if defined(ENABLE_HAL_AES)
+/*
+ * encrypt a single 16-byte block in place with the given 16-byte key,
+ * using AES hardware if available.
+ *   - return 1 if the block was encrypted
+ *   - return 0 to have the software AES implementation encrypt it
+ */
+u1_t hal_aes_encrypt (u1_t* data, const u1_t* key);
+#endif
+
+#if defined(ENABLE_SESSION_STORE)
+/*
+ * read len bytes at the given offset of the non-volatile session storage.
+ *   - bytes never written read as 0xFF
+ */
+void hal_store_read (u2_t addr, u1_t* buf, u2_t len);
+
+/*
+ * write len bytes at the given offset of the session storage.
+ */
+void hal_store_write (u2_t addr, const u1_t* buf, u2_t len);
+#endif
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -165,18 +165,6 @@ static void aes_appendMic0 (xref2u1_t pdu, int len) {
 }
 
 
-static int aes_verifyMic0 (xref2u1_t pdu, int len) {
-    os_getDevKey(AESkey);
-    return os_aes(AES_MIC|AES_MICNOAUX, pdu, len) == os_rmsbf4(pdu+len);
-}
-
-
-static void aes_encrypt (xref2u1_t pdu, int len) {
-    os_getDevKey(AESkey);
-    os_aes(AES_ENC, pdu, len);
-}
-
-
 static void aes_cipher (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t payload, int len) {
     if( len <= 0 )
         return;
@@ -190,18 +178,53 @@ static void aes_cipher (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xre
 }
 
 
-static void aes_sessKeys (u2_t devnonce, xref2cu1_t artnonce, xref2u1_t nwkkey, xref2u1_t artkey) {
-    os_clearMem(nwkkey, 16);
-    nwkkey[0] = 0x01;
-    os_copyMem(nwkkey+1, artnonce, LEN_ARTNONCE+LEN_NETID);
-    os_wlsbf2(nwkkey+1+LEN_ARTNONCE+LEN_NETID, devnonce);
-    os_copyMem(artkey, nwkkey, 16);
-    artkey[0] = 0x02;
+#if defined(ENABLE_TX_KEYSTREAM)
+// Compute the keystream for the FRMPayload of the next uplink. This
+// depends only on the session and the seqno, so it can be done before
+// the application provides any data. Port 0 payloads are encrypted
+// with nwkKey and do not use the keystream.
+static void runKeystream (xref2osjob_t osjob) {
+    if( LMIC.devaddr == 0 || (LMIC.opmode & OP_TXRXPEND) != 0 )
+        return; // rescheduled when the transmission completes
+    os_clearMem(LMIC.keystream, MAX_LEN_PAYLOAD);
+    aes_cipher(LMIC.artKey, LMIC.devaddr, LMIC.seqnoUp, /*up*/0, LMIC.keystream, MAX_LEN_PAYLOAD);
+    LMIC.ksSeqno = LMIC.seqnoUp;
+    LMIC.ksValid = 1;
+}
 
-    os_getDevKey(AESkey);
-    os_aes(AES_ENC, nwkkey, 16);
-    os_getDevKey(AESkey);
-    os_aes(AES_ENC, artkey, 16);
+
+static void scheduleKeystream (void) {
+    LMIC.ksValid = 0;
+    os_setCallback(&LMIC.ksjob, FUNC_ADDR(runKeystream));
+}
+#endif // ENABLE_TX_KEYSTREAM
+
+
+// Decrypt and verify a join accept frame of the given length (including
+// MIC) and derive the session keys from it. The device key is fetched
+// only once and both session keys are derived in a single two block
+// call. On success, sesskeys holds the network session key followed by
+// the application session key. Returns 0 if the MIC does not match.
+static int aes_joinAccept (xref2u1_t pdu, int len, u2_t devnonce, xref2u1_t sesskeys) {
+    u1_t devkey[16];
+    os_getDevKey(devkey);
+
+    os_copyMem(AESkey, devkey, 16);
+    os_aes(AES_ENC, pdu+1, len-1);
+    os_copyMem(AESkey, devkey, 16);
+    if( os_aes(AES_MIC|AES_MICNOAUX, pdu, len-4) != os_rmsbf4(pdu+len-4) )
+        return 0;
+
+    os_clearMem(sesskeys, 16);
+    sesskeys[0] = 0x01;
+    os_copyMem(sesskeys+1, pdu+OFF_JA_ARTNONCE, LEN_ARTNONCE+LEN_NETID);
+    os_wlsbf2(sesskeys+1+LEN_ARTNONCE+LEN_NETID, devnonce);
+    os_copyMem(sesskeys+16, sesskeys, 16);
+    sesskeys[16] = 0x02;
+
+    os_copyMem(AESkey, devkey, 16);
+    os_aes(AES_ENC, sesskeys, 32);
+    return 1;
 }
 
 // END AES
@@ -213,8 +236,9 @@ static void aes_sessKeys (u2_t devnonce, xref2cu1_t artnonce, xref2u1_t nwkkey,
 
 #if defined(CFG_eu868) // ========================================
 
-#define maxFrameLen(dr) ((dr)<=DR_SF9 ? TABLE_GET_U1(maxFrameLens, (dr)) : 0xFF)
-CONST_TABLE(u1_t, maxFrameLens) [] = { 64,64,64,123 };
+// Maximum PHY payload per datarate. FSK is limited by the radio FIFO.
+#define maxFrameLen(dr) ((dr)<=DR_FSK ? TABLE_GET_U1(maxFrameLens, (dr)) : 0xFF)
+CONST_TABLE(u1_t, maxFrameLens) [] = { 64,64,64,128,255,255,255,63 };
 
 CONST_TABLE(u1_t, _DR2RPS_CRC)[] = {
     ILLEGAL_RPS,
@@ -278,9 +302,153 @@ int getSensitivity (rps_t rps) {
     return -141 + TABLE_GET_U1_TWODIM(SENSITIVITY, getSf(rps), getBw(rps));
 }
 
+#if defined(ENABLE_AIRTIME_TABLE)
+// Airtime in osticks for the data rates of the region and every frame
+// length up to MAX_LEN_FRAME, computed by the compiler with exactly the
+// same integer arithmetic as calcAirTime() below. The LoRa rows assume
+// CR 4/5, CRC on and an explicit header, which is what LMIC transmits
+// with; other settings fall back to the formula.
+#define AT_SFX(sf)       (4*(sf))
+#define AT_Q(sf)         (AT_SFX(sf) - ((sf) >= 11 ? 8 : 0))
+#define AT_TMP(sf,n)     (8*(n) - AT_SFX(sf) + 28 + 16)
+#define AT_SYM(sf,n)     ((AT_TMP(sf,n) > 0 ? (AT_TMP(sf,n) + AT_Q(sf) - 1) / AT_Q(sf) * 5 + 8 : 8) * 4 + 49)
+#define AT_SH(sf,bw)     ((sf) - (3+2) - (bw))
+#define AT_DIV(sf,bw)    (AT_SH(sf,bw) > 4 ? 15625 >> (AT_SH(sf,bw)-4) : 15625)
+#define AT_LORA(sf,bw,n) ((((ostime_t)AT_SYM(sf,n) << (AT_SH(sf,bw) > 4 ? 4 : AT_SH(sf,bw))) * OSTICKS_PER_SEC \
+                           + AT_DIV(sf,bw)/2) / AT_DIV(sf,bw))
+#define AT_FSK(n)        (((n)+5+3+1+2) * 8 * (s4_t)OSTICKS_PER_SEC / 50000)
+
+// Row entries are generated in chunks of 16 frame lengths
+#define AT_4(r,n)   r(n), r((n)+1), r((n)+2), r((n)+3)
+#define AT_16(r,n)  AT_4(r,n), AT_4(r,(n)+4), AT_4(r,(n)+8), AT_4(r,(n)+12)
+#if LMIC_MAX_FRAME_LENGTH >= 80
+#define AT_80(r)  , AT_16(r,80)
+#else
+#define AT_80(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 96
+#define AT_96(r)  , AT_16(r,96)
+#else
+#define AT_96(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 112
+#define AT_112(r) , AT_16(r,112)
+#else
+#define AT_112(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 128
+#define AT_128(r) , AT_16(r,128)
+#else
+#define AT_128(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 144
+#define AT_144(r) , AT_16(r,144)
+#else
+#define AT_144(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 160
+#define AT_160(r) , AT_16(r,160)
+#else
+#define AT_160(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 176
+#define AT_176(r) , AT_16(r,176)
+#else
+#define AT_176(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 192
+#define AT_192(r) , AT_16(r,192)
+#else
+#define AT_192(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 208
+#define AT_208(r) , AT_16(r,208)
+#else
+#define AT_208(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 224
+#define AT_224(r) , AT_16(r,224)
+#else
+#define AT_224(r)
+#endif
+#if LMIC_MAX_FRAME_LENGTH >= 240
+#define AT_240(r) , AT_16(r,240)
+#else
+#define AT_240(r)
+#endif
+#define AT_COLS   ((LMIC_MAX_FRAME_LENGTH/16+1)*16)
+#define AT_ROW(r) AT_16(r,0), AT_16(r,16), AT_16(r,32), AT_16(r,48), AT_16(r,64) \
+                  AT_80(r) AT_96(r) AT_112(r) AT_128(r) AT_144(r) AT_160(r) \
+                  AT_176(r) AT_192(r) AT_208(r) AT_224(r) AT_240(r)
+
+#define AT_SF7B125(n)  AT_LORA(7,0,n)
+#define AT_SF8B125(n)  AT_LORA(8,0,n)
+#define AT_SF9B125(n)  AT_LORA(9,0,n)
+#define AT_SF10B125(n) AT_LORA(10,0,n)
+#if defined(CFG_eu868) // ========================================
+#define AT_SF11B125(n) AT_LORA(11,0,n)
+#define AT_SF12B125(n) AT_LORA(12,0,n)
+#define AT_SF7B250(n)  AT_LORA(7,1,n)
+
+enum { AT_NONE = 0xFF };
+// Row of AIRTIME for each sf/bw combination
+static CONST_TABLE(u1_t, AIRTIME_ROW)[7][3] = {
+    // ------------bw----------
+    // 125kHz    250kHz    500kHz
+    {       7,  AT_NONE,  AT_NONE },  // FSK
+    {       5,        6,  AT_NONE },  // SF7
+    {       4,  AT_NONE,  AT_NONE },  // SF8
+    {       3,  AT_NONE,  AT_NONE },  // SF9
+    {       2,  AT_NONE,  AT_NONE },  // SF10
+    {       1,  AT_NONE,  AT_NONE },  // SF11
+    {       0,  AT_NONE,  AT_NONE }   // SF12
+};
+
+static CONST_TABLE(ostime_t, AIRTIME)[8*AT_COLS] = {
+    AT_ROW(AT_SF12B125), AT_ROW(AT_SF11B125), AT_ROW(AT_SF10B125), AT_ROW(AT_SF9B125),
+    AT_ROW(AT_SF8B125),  AT_ROW(AT_SF7B125),  AT_ROW(AT_SF7B250),  AT_ROW(AT_FSK)
+};
+#elif defined(CFG_us915) // ======================================
+#define AT_SF7B500(n)  AT_LORA(7,2,n)
+#define AT_SF8B500(n)  AT_LORA(8,2,n)
+#define AT_SF9B500(n)  AT_LORA(9,2,n)
+#define AT_SF10B500(n) AT_LORA(10,2,n)
+#define AT_SF11B500(n) AT_LORA(11,2,n)
+#define AT_SF12B500(n) AT_LORA(12,2,n)
+
+enum { AT_NONE = 0xFF };
+// Row of AIRTIME for each sf/bw combination
+static CONST_TABLE(u1_t, AIRTIME_ROW)[7][3] = {
+    // ------------bw----------
+    // 125kHz    250kHz    500kHz
+    { AT_NONE,  AT_NONE,  AT_NONE },  // FSK
+    {       3,  AT_NONE,        9 },  // SF7
+    {       2,  AT_NONE,        8 },  // SF8
+    {       1,  AT_NONE,        7 },  // SF9
+    {       0,  AT_NONE,        6 },  // SF10
+    { AT_NONE,  AT_NONE,        5 },  // SF11
+    { AT_NONE,  AT_NONE,        4 }   // SF12
+};
+
+static CONST_TABLE(ostime_t, AIRTIME)[10*AT_COLS] = {
+    AT_ROW(AT_SF10B125), AT_ROW(AT_SF9B125),  AT_ROW(AT_SF8B125),  AT_ROW(AT_SF7B125),
+    AT_ROW(AT_SF12B500), AT_ROW(AT_SF11B500), AT_ROW(AT_SF10B500), AT_ROW(AT_SF9B500),
+    AT_ROW(AT_SF8B500),  AT_ROW(AT_SF7B500)
+};
+#endif // ===================================================
+#endif // ENABLE_AIRTIME_TABLE
+
 ostime_t calcAirTime (rps_t rps, u1_t plen) {
     u1_t bw = getBw(rps);  // 0,1,2 = 125,250,500kHz
     u1_t sf = getSf(rps);  // 0=FSK, 1..6 = SF7..12
+#if defined(ENABLE_AIRTIME_TABLE)
+    if( plen <= MAX_LEN_FRAME
+        && (sf == FSK || (getCr(rps) == CR_4_5 && !getNocrc(rps) && !getIh(rps))) ) {
+        u1_t row = TABLE_GET_U1_TWODIM(AIRTIME_ROW, sf, bw);
+        if( row != AT_NONE )
+            return TABLE_GET_OSTIME(AIRTIME, row*AT_COLS + plen);
+    }
+#endif // ENABLE_AIRTIME_TABLE
     if( sf == FSK ) {
         return (plen+/*preamble*/5+/*syncword*/3+/*len*/1+/*crc*/2) * /*bits/byte*/8
             * (s4_t)OSTICKS_PER_SEC / /*kbit/s*/50000;
@@ -415,30 +583,163 @@ static void calcBcnRxWindowFromMillis (u1_t ms, bit_t ini) {
         LMIC.maxDriftDiff = 0;
         LMIC.missedBcns = 0;
         LMIC.bcninfo.flags |= BCN_NODRIFT|BCN_NODDIFF;
+#if defined(ENABLE_DRIFT_MODEL)
+        LMIC.dmCnt = 0;
+#endif
     }
     ostime_t hsym = dr2hsym(DR_BCN);
     LMIC.bcnRxsyms = MINRX_SYMS + ms2osticksCeil(ms) / hsym;
     LMIC.bcnRxtime = LMIC.bcninfo.txtime + BCN_INTV_osticks - (LMIC.bcnRxsyms-PAMBL_SYMS) * hsym;
 }
+
+
+#if defined(ENABLE_DRIFT_MODEL)
+#if !defined(LMIC_DRIFT_WANDER_us)
+#define LMIC_DRIFT_WANDER_us 60
+#endif
+enum { DRIFT_MIN    = 3 };   // samples needed for a prediction
+enum { DRIFT_SIGMAS = 3 };   // window half width in prediction errors
+
+static u4_t isqrt (u4_t v) {
+    u4_t r = 0, b = (u4_t)1 << 30;
+    while( b > v )
+        b >>= 2;
+    while( b != 0 ) {
+        if( v >= r + b ) {
+            v -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+        b >>= 2;
+    }
+    return r;
+}
+
+// Add the beacon received at LMIC.bcninfo.txtime, gap beacon periods after
+// the previous one. Samples are kept newest first as offsets from a time
+// line with exactly BCN_INTV_osticks per period through the newest
+// beacon, so their slope is the clock drift.
+static void driftSample (u1_t gap) {
+    ostime_t shift = LMIC.bcninfo.txtime - LMIC.dmRef - gap * BCN_INTV_osticks;
+    u1_t cnt = LMIC.dmCnt < LMIC_DRIFT_WINDOW ? LMIC.dmCnt : LMIC_DRIFT_WINDOW-1;
+    while( cnt > 0 && LMIC.dmAge[cnt-1] > 255-gap )
+        cnt--;
+    for( u1_t i=cnt; i>0; i-- ) {
+        LMIC.dmOff[i] = LMIC.dmOff[i-1] - shift;
+        LMIC.dmAge[i] = LMIC.dmAge[i-1] + gap;
+    }
+    LMIC.dmOff[0] = 0;
+    LMIC.dmAge[0] = 0;
+    LMIC.dmCnt = cnt+1;
+    LMIC.dmRef = LMIC.bcninfo.txtime;
+}
+
+// Predict the arrival of the beacon ahead periods after the newest one by
+// a least squares fit of the samples. off is set to the offset from the
+// nominal arrival, bound to the error bound of the prediction, which
+// grows the further ahead the prediction is. Returns 0 if there are not
+// enough samples.
+static bit_t driftPredict (u1_t ahead, ostime_t* off, ostime_t* bound) {
+    s4_t n = LMIC.dmCnt;
+    if( n < DRIFT_MIN )
+        return 0;
+    s4_t sx = 0, sxx = 0;
+    int64_t sy = 0, sxy = 0;
+    for( u1_t i=0; i<n; i++ ) {
+        s4_t x = -(s4_t)LMIC.dmAge[i];
+        sx  += x;
+        sxx += x * x;
+        sy  += LMIC.dmOff[i];
+        sxy += (int64_t)x * LMIC.dmOff[i];
+    }
+    // Fitted line: y(x) = (sy*d + b*(n*x-sx)) / (n*d)
+    int64_t d  = (int64_t)n * sxx - (int64_t)sx * sx;
+    int64_t b  = n * sxy - sx * sy;
+    int64_t nd = n * d;
+    int64_t sse = 0;
+    for( u1_t i=0; i<n; i++ ) {
+        int64_t r = ((int64_t)LMIC.dmOff[i] * nd - (sy * d + b * (n * -(s4_t)LMIC.dmAge[i] - sx))) / nd;
+        sse += r * r;
+    }
+    int64_t s2 = sse / (n-2);
+    if( s2 < 1 )
+        s2 = 1;   // timestamp resolution
+    int64_t xo = n * (s4_t)ahead - sx;
+    *off = (ostime_t)((sy * d + b * xo) / nd);
+    // Variance of a new observation at ahead: s2 * (1 + 1/n + (x-mean)^2/Sxx)
+    int64_t var = s2 * (nd + d + xo * xo) / nd;
+    *bound = DRIFT_SIGMAS * (ostime_t)isqrt(var > 0xFFFFFFFF ? 0xFFFFFFFF : (u4_t)var)
+        + ahead * us2osticksCeil(LMIC_DRIFT_WANDER_us);
+    return 1;
+}
+
+// Center the next beacon window on the predicted arrival and size it by
+// the error bound.
+static void driftWindow (void) {
+    ostime_t off, bound;
+    u1_t ahead = LMIC.missedBcns+1;
+    if( !driftPredict(ahead, &off, &bound) )
+        return;
+    ostime_t hsym = dr2hsym(DR_BCN);
+    ostime_t extra = bound / hsym;
+    LMIC.bcnRxsyms = MINRX_SYMS + (extra > MAX_RXSYMS ? MAX_RXSYMS : extra);
+    // Center the window on the predicted arrival, also when it is capped
+    LMIC.bcnRxtime = LMIC.dmRef + ahead * BCN_INTV_osticks + off
+        - (LMIC.bcnRxsyms-PAMBL_SYMS) * hsym;
+}
+#endif // ENABLE_DRIFT_MODEL
 #endif // !DISABLE_BEACONS
 
 
 #if !defined(DISABLE_PING)
-// Setup scheduled RX window (ping/multicast slot)
-static void rxschedInit (xref2rxsched_t rxsched) {
+// Compute the random slot offset of addr for the beacon period starting at
+// GPS time, unless already known. The offset of the next period is
+// computed ahead of time (see pingNext), so the AES block does not delay
+// other jobs right after the beacon.
+static void rxschedRnd (xref2rxsched_t rxsched, devaddr_t addr, u4_t time) {
+    if( rxsched->rndTime == time && rxsched->rndAddr == addr )
+        return;
+    u1_t buf[16];
     os_clearMem(AESkey,16);
-    os_clearMem(LMIC.frame+8,8);
-    os_wlsbf4(LMIC.frame, LMIC.bcninfo.time);
-    os_wlsbf4(LMIC.frame+4, LMIC.devaddr);
-    os_aes(AES_ENC,LMIC.frame,16);
+    os_clearMem(buf+8,8);
+    os_wlsbf4(buf, time);
+    os_wlsbf4(buf+4, addr);
+    os_aes(AES_ENC,buf,16);
+    rxsched->rnd     = os_rlsbf2(buf);
+    rxsched->rndTime = time;
+    rxsched->rndAddr = addr;
+}
+
+
+// Set the RX window of the current slot.
+static void rxschedSlot (xref2rxsched_t rxsched) {
+    u1_t dist = rxsched->slot + (1<<rxsched->intvExp);  // 1..128
+    rxsched->rxtime = rxsched->rxbase
+        + (rxsched->slotpos >> BCN_INTV_exp)
+        - (MINRX_SYMS-PAMBL_SYMS) * dr2hsym(rxsched->dr);
+    rxsched->rxsyms = rxsched->segsyms[(dist-1) / (128/RXSCHED_SEGS)];
+}
+
+
+// Setup scheduled RX window (ping/multicast slot)
+static void rxschedInit (xref2rxsched_t rxsched, devaddr_t addr) {
+    rxschedRnd(rxsched, addr, LMIC.bcninfo.time);
     u1_t intvExp = rxsched->intvExp;
-    ostime_t off = os_rlsbf2(LMIC.frame) & (0x0FFF >> (7 - intvExp)); // random offset (slot units)
+    ostime_t off = rxsched->rnd & (0x0FFF >> (7 - intvExp)); // random offset (slot units)
     rxsched->rxbase = (LMIC.bcninfo.txtime +
                        BCN_RESERVE_osticks +
                        ms2osticks(BCN_SLOT_SPAN_ms * off)); // random offset osticks
     rxsched->slot   = 0;
-    rxsched->rxtime = rxsched->rxbase - calcRxWindow(/*secs BCN_RESERVE*/2+(1<<intvExp),rxsched->dr);
-    rxsched->rxsyms = LMIC.rxsyms;
+    // The drift is fixed for the beacon period, so the window widening is
+    // taken from a table - at the end of each segment of the period to be
+    // safe - and the drift correction is advanced with each slot.
+    for( u1_t seg=0; seg<RXSCHED_SEGS; seg++ ) {
+        calcRxWindow(/*secs BCN_RESERVE*/2+(seg+1)*(128/RXSCHED_SEGS), rxsched->dr);
+        rxsched->segsyms[seg] = LMIC.rxsyms;
+    }
+    rxsched->slotpos = -LMIC.drift * (ostime_t)(/*secs BCN_RESERVE*/2+(1<<intvExp));
+    rxschedSlot(rxsched);
 }
 
 
@@ -452,12 +753,49 @@ static bit_t rxschedNext (xref2rxsched_t rxsched, ostime_t cando) {
     u1_t intv = 1<<rxsched->intvExp;
     if( (rxsched->slot = (slot += (intv))) >= 128 )
         return 0;
-    rxsched->rxtime = rxsched->rxbase
-        + ((BCN_WINDOW_osticks * (ostime_t)slot) >> BCN_INTV_exp)
-        - calcRxWindow(/*secs BCN_RESERVE*/2+slot+intv,rxsched->dr);
-    rxsched->rxsyms = LMIC.rxsyms;
+    rxsched->slotpos += (BCN_WINDOW_osticks - LMIC.drift) << rxsched->intvExp;
+    rxschedSlot(rxsched);
     goto again;
 }
+
+
+// Setup the RX slots of the current beacon period for the device and
+// the multicast groups with ping slots.
+static void pingInit (void) {
+    rxschedInit(&LMIC.ping, LMIC.devaddr);
+#if defined(ENABLE_MULTICAST)
+    for( u1_t gi=0; gi<LMIC_MCAST_GROUPS; gi++ ) {
+        mcgroup_t* g = &LMIC.mcGroups[gi];
+        if( g->addr != 0 && g->ping.intvExp <= 7 )
+            rxschedInit(&g->ping, g->addr);
+    }
+#endif // ENABLE_MULTICAST
+}
+
+
+// Find the earliest RX slot starting not before cando, or NULL if there
+// is none left in this beacon period.
+// Once a schedule has no slots left, the offset for the next beacon
+// period is prepared.
+static xref2rxsched_t pingNext (ostime_t cando) {
+    xref2rxsched_t next = (xref2rxsched_t)0;
+    if( rxschedNext(&LMIC.ping, cando) )
+        next = &LMIC.ping;
+    else
+        rxschedRnd(&LMIC.ping, LMIC.devaddr, LMIC.bcninfo.time + BCN_INTV_sec);
+#if defined(ENABLE_MULTICAST)
+    for( u1_t gi=0; gi<LMIC_MCAST_GROUPS; gi++ ) {
+        mcgroup_t* g = &LMIC.mcGroups[gi];
+        if( g->addr == 0 || g->ping.intvExp > 7 )
+            continue;
+        if( !rxschedNext(&g->ping, cando) )
+            rxschedRnd(&g->ping, g->addr, LMIC.bcninfo.time + BCN_INTV_sec);
+        else if( next == (xref2rxsched_t)0 || g->ping.rxtime - next->rxtime < 0 )
+            next = &g->ping;
+    }
+#endif // ENABLE_MULTICAST
+    return next;
+}
 #endif // !DISABLE_PING)
 
 
@@ -493,6 +831,107 @@ static void setDrJoin (u1_t reason, u1_t dr) {
 }
 
 
+#if defined(ENABLE_JOIN_STRATEGY)
+#if !defined(LMIC_JOIN_BACKOFF_sec)
+#define LMIC_JOIN_BACKOFF_sec 8
+#endif
+#if !defined(LMIC_JOIN_BACKOFF_MAX_sec)
+#define LMIC_JOIN_BACKOFF_MAX_sec 3600
+#endif
+#if !defined(LMIC_JOIN_AIRTIME_ms)
+#define LMIC_JOIN_AIRTIME_ms 36000
+#endif
+
+// Join state kept outside of LMIC, so it also covers joining again after
+// an LMIC_reset(), e.g. once the network stopped answering.
+static struct {
+    u4_t           capMs;     // join airtime per hour (0=no limit)
+    joinstrategy_t strategy;  // 0 for joinDrDefault()
+    ostime_t       lastEnd;   // end of the last join request
+    ostime_t       off;       // time to wait after it for the airtime limit
+    u2_t           nonce;     // next devNonce
+    u1_t           lastDr;    // datarate of the last successful join, or DR_NONE
+    u1_t           backoff;   // number of times the backoff was doubled
+    u1_t           init;      // nonce and lastDr are set
+} JOIN = { .capMs = LMIC_JOIN_AIRTIME_ms };
+
+static dr_t joinDrDefault (u1_t attempt, dr_t lastDr);
+
+
+static void joinInit (void) {
+    if( JOIN.init )
+        return;
+    JOIN.init = 1;
+#if defined(ENABLE_SESSION_STORE)
+    store_loadJoin(&JOIN.nonce, &JOIN.lastDr);
+#else
+    // Without a store, the nonce only increments until the next reboot
+    JOIN.nonce = LMIC.devNonce;
+    JOIN.lastDr = DR_NONE;
+#endif
+}
+
+
+// Datarate of the next join attempt, LMIC.txCnt is the attempt number.
+// When the strategy is done, the next round starts without the last
+// datarate, since the device might have moved.
+static dr_t joinNextDr (u1_t* failed) {
+    joinstrategy_t strategy = JOIN.strategy != 0 ? JOIN.strategy : FUNC_ADDR(joinDrDefault);
+    dr_t dr = strategy(++LMIC.txCnt, JOIN.lastDr);
+    if( dr == DR_NONE ) {
+        *failed = 1;
+        LMIC.txCnt = 0;
+        JOIN.lastDr = DR_NONE;
+        dr = strategy(0, DR_NONE);
+    }
+    return dr;
+}
+
+
+// Start of the next join request at or after time: a random delay within
+// a window which doubles with each attempt, and no earlier than the join
+// airtime limit allows. The limit works like a duty cycle, so after a
+// join request the next one waits airtime * (1h/capMs - 1).
+static ostime_t joinTxBeg (ostime_t time) {
+    u4_t span = (u4_t)LMIC_JOIN_BACKOFF_sec << JOIN.backoff;
+    if( span >= LMIC_JOIN_BACKOFF_MAX_sec )
+        span = LMIC_JOIN_BACKOFF_MAX_sec;
+    else
+        JOIN.backoff++;
+    time += (ostime_t)(((int64_t)sec2osticks(span) * os_getRndU2()) >> 16);
+    // lastEnd after time means it has wrapped around, so it is long ago
+    ostime_t avail = JOIN.lastEnd + JOIN.off;
+    if( time - JOIN.lastEnd >= 0 && time - avail < 0 )
+        time = avail;
+    return time;
+}
+
+
+// Called when a join request is about to be sent.
+static void joinSent (void) {
+    // The nonce must be stored before it is sent, so it is never reused
+    JOIN.nonce = LMIC.devNonce;
+#if defined(ENABLE_SESSION_STORE)
+    store_join(JOIN.nonce, JOIN.lastDr);
+#endif
+    ostime_t airtime = calcAirTime(setCr(updr2rps(LMIC.datarate), (cr_t)LMIC.errcr), LEN_JR);
+    JOIN.lastEnd = os_getTime() + airtime;
+    JOIN.off = 0;
+    if( JOIN.capMs != 0 && JOIN.capMs < 3600000 )
+        JOIN.off = (ostime_t)((int64_t)airtime * 3600000 / JOIN.capMs) - airtime;
+}
+
+
+// Called when a join has succeeded.
+static void joinDone (void) {
+    JOIN.backoff = 0;
+#if defined(ENABLE_SESSION_STORE)
+    store_join(JOIN.nonce, JOIN.lastDr);
+#endif
+}
+#endif // ENABLE_JOIN_STRATEGY
+
+
 static void setDrTxpow (u1_t reason, u1_t dr, s1_t pow) {
     EV(drChange, INFO, (e_.reason    = reason,
                         e_.deveui    = MAIN::CDEV->getEui(),
@@ -511,6 +950,65 @@ static void setDrTxpow (u1_t reason, u1_t dr, s1_t pow) {
 }
 
 
+#if defined(ENABLE_CHANNEL_STATS)
+#if !defined(LMIC_CHNL_FAILS)
+#define LMIC_CHNL_FAILS 3
+#endif
+#if !defined(LMIC_CHNL_PENALTY)
+#define LMIC_CHNL_PENALTY 600
+#endif
+#if !defined(LMIC_CHNL_MIN)
+#define LMIC_CHNL_MIN 2
+#endif
+
+// Record whether the last data frame on LMIC.txChnl was answered. A
+// channel with LMIC_CHNL_FAILS unanswered confirmed frames in a row is
+// avoided until LMIC_CHNL_PENALTY seconds after the last of them.
+static void chnlResult (bit_t ok) {
+    u1_t chnl = LMIC.txChnl;
+    chnlstat_t* st = &LMIC.chnlStats[chnl];
+    if( !ok ) {
+        st->lastFail = os_getTime();
+        if( st->fails < 255 && ++st->fails >= LMIC_CHNL_FAILS )
+            LMIC.chnlBad[chnl>>4] |= 1 << (chnl & 0xF);
+        return;
+    }
+    s1_t rssi = LMIC.rssi - RSSI_OFF;
+    s1_t snr = LMIC.snr / SNR_SCALEUP;
+    if( st->okCnt++ == 0 ) {
+        st->rssi = rssi;
+        st->snr = snr;
+    } else {
+        st->rssi += (rssi - st->rssi) / 4;
+        st->snr += (snr - st->snr) / 4;
+    }
+    st->fails = 0;
+    LMIC.chnlBad[chnl>>4] &= ~(1 << (chnl & 0xF));
+}
+
+// Remove the avoided channels from the n channel map words in map, which
+// start at channel 16*w, as long as LMIC_CHNL_MIN channels remain.
+static void chnlAvoid (u2_t* map, u1_t w, u1_t n) {
+    ostime_t now = os_getTime();
+    u2_t good[4];
+    u1_t cnt = 0;
+    for( u1_t i=0; i<n; i++ ) {
+        u2_t bad = LMIC.chnlBad[w+i] & map[i];
+        while( bad != 0 ) {
+            u1_t b = os_ctz2(bad);
+            bad &= bad-1;
+            if( now - LMIC.chnlStats[16*(w+i)+b].lastFail >= sec2osticks(LMIC_CHNL_PENALTY) )
+                LMIC.chnlBad[w+i] &= ~(1 << b);
+        }
+        good[i] = map[i] & ~LMIC.chnlBad[w+i];
+        cnt += os_popcount2(good[i]);
+    }
+    if( cnt >= LMIC_CHNL_MIN )
+        os_copyMem(map, good, n*sizeof(u2_t));
+}
+#endif // ENABLE_CHANNEL_STATS
+
+
 #if !defined(DISABLE_PING)
 void LMIC_stopPingable (void) {
     LMIC.opmode &= ~(OP_PINGABLE|OP_PINGINI);
@@ -542,9 +1040,27 @@ static CONST_TABLE(u4_t, iniChannelFreq)[6] = {
     EU868_F1|BAND_CENTI, EU868_F2|BAND_CENTI, EU868_F3|BAND_CENTI,
 };
 
+// Update the per-band and per-datarate channel masks used by nextTx
+// after the frequency or datarate range of a channel has changed.
+static void updateChnlMaps (u1_t chnl) {
+    u2_t bit = (u2_t)1 << chnl;
+    u2_t drmap = LMIC.channelDrMap[chnl];
+    for( u1_t bi=0; bi<MAX_BANDS; bi++ )
+        LMIC.bandChnlMap[bi] &= ~bit;
+    LMIC.bandChnlMap[LMIC.channelFreq[chnl] & 0x3] |= bit;
+    for( u1_t dr=0; dr<DR_NONE; dr++ ) {
+        if( (drmap & (1<<dr)) != 0 )
+            LMIC.drChnlMap[dr] |= bit;
+        else
+            LMIC.drChnlMap[dr] &= ~bit;
+    }
+}
+
 static void initDefaultChannels (bit_t join) {
     os_clearMem(&LMIC.channelFreq, sizeof(LMIC.channelFreq));
     os_clearMem(&LMIC.channelDrMap, sizeof(LMIC.channelDrMap));
+    os_clearMem(&LMIC.bandChnlMap, sizeof(LMIC.bandChnlMap));
+    os_clearMem(&LMIC.drChnlMap, sizeof(LMIC.drChnlMap));
     os_clearMem(&LMIC.bands, sizeof(LMIC.bands));
 
     LMIC.channelMap = 0x07;
@@ -552,6 +1068,7 @@ static void initDefaultChannels (bit_t join) {
     for( u1_t fu=0; fu<3; fu++,su++ ) {
         LMIC.channelFreq[fu]  = TABLE_GET_U4(iniChannelFreq, su);
         LMIC.channelDrMap[fu] = DR_RANGE_MAP(DR_SF12,DR_SF7);
+        updateChnlMaps(fu);
     }
 
     LMIC.bands[BAND_MILLI].txcap    = 1000;  // 0.1%
@@ -578,6 +1095,14 @@ bit_t LMIC_setupBand (u1_t bandidx, s1_t txpow, u2_t txcap) {
     return 1;
 }
 
+//! \brief Get the time from which a band may be used again, as limited by
+//! its duty cycle. This lies in the past if the band is available now.
+//! \return the availability time, or 0 for an invalid band.
+ostime_t LMIC_bandAvail (u1_t bandidx) {
+    if( bandidx > BAND_AUX ) return 0;
+    return LMIC.bands[bandidx].avail;
+}
+
 bit_t LMIC_setupChannel (u1_t chidx, u4_t freq, u2_t drmap, s1_t band) {
     if( chidx >= MAX_CHANNELS )
         return 0;
@@ -596,6 +1121,8 @@ bit_t LMIC_setupChannel (u1_t chidx, u4_t freq, u2_t drmap, s1_t band) {
     LMIC.channelFreq [chidx] = freq;
     LMIC.channelDrMap[chidx] = drmap==0 ? DR_RANGE_MAP(DR_SF12,DR_SF7) : drmap;
     LMIC.channelMap |= 1<<chidx;  // enabled right away
+    updateChnlMaps(chidx);
+    DO_DEVDB(LMIC.channelMap,channelMap);
     return 1;
 }
 
@@ -603,6 +1130,8 @@ void LMIC_disableChannel (u1_t channel) {
     LMIC.channelFreq[channel] = 0;
     LMIC.channelDrMap[channel] = 0;
     LMIC.channelMap &= ~(1<<channel);
+    updateChnlMaps(channel);
+    DO_DEVDB(LMIC.channelMap,channelMap);
 }
 
 static u4_t convFreq (xref2u1_t ptr) {
@@ -621,6 +1150,7 @@ static u1_t mapChannels (u1_t chpage, u2_t chmap) {
             chmap &= ~(1<<chnl); // ignore - channel is not defined
     }
     LMIC.channelMap = chmap;
+    DO_DEVDB(LMIC.channelMap,channelMap);
     return 1;
 }
 
@@ -638,32 +1168,55 @@ static void updateTx (ostime_t txbeg) {
         LMIC.globalDutyAvail = txbeg + (airtime<<LMIC.globalDutyRate);
 }
 
+// Find the band becoming available first among those with a channel in
+// drmap (or among all bands if there is none) and lower mintime to the
+// time it becomes available.
+static u1_t availBand (u2_t drmap, ostime_t* mintime) {
+    u1_t bmap = 0;
+    for( u1_t bi=0; bi<4; bi++ ) {
+        if( (LMIC.bandChnlMap[bi] & drmap) != 0 )
+            bmap |= 1<<bi;
+    }
+    if( bmap == 0 )
+        bmap = 0xF;  // No feasible channel found! Keep old one.
+    u1_t band=0;
+    for( u1_t bi=0; bi<4; bi++ ) {
+        if( (bmap & (1<<bi)) && *mintime - LMIC.bands[bi].avail > 0 )
+            *mintime = LMIC.bands[band = bi].avail;
+    }
+    return band;
+}
+
+// Earliest time a channel for the given datarate is available. Returns 0
+// if no enabled channel supports the datarate.
+static bit_t chnlAvail (dr_t dr, ostime_t* avail) {
+    u2_t drmap = LMIC.channelMap & LMIC.drChnlMap[dr];
+    *avail = os_getTime() + /*8h*/sec2osticks(28800);
+    availBand(drmap, avail);
+    return drmap != 0;
+}
+
+#if defined(ENABLE_AIRTIME_BUDGET)
+static bit_t chnlSupportsDr (u1_t chnl, u1_t dr) {
+    return (LMIC.channelDrMap[chnl] & (1<<dr)) != 0;
+}
+#endif // ENABLE_AIRTIME_BUDGET
+
 static ostime_t nextTx (ostime_t now) {
-    u1_t bmap=0xF;
-    do {
-        ostime_t mintime = now + /*8h*/sec2osticks(28800);
-        u1_t band=0;
-        for( u1_t bi=0; bi<4; bi++ ) {
-            if( (bmap & (1<<bi)) && mintime - LMIC.bands[bi].avail > 0 )
-                mintime = LMIC.bands[band = bi].avail;
-        }
-        // Find next channel in given band
-        u1_t chnl = LMIC.bands[band].lastchnl;
-        for( u1_t ci=0; ci<MAX_CHANNELS; ci++ ) {
-            if( (chnl = (chnl+1)) >= MAX_CHANNELS )
-                chnl -=  MAX_CHANNELS;
-            if( (LMIC.channelMap & (1<<chnl)) != 0  &&  // channel enabled
-                (LMIC.channelDrMap[chnl] & (1<<(LMIC.datarate&0xF))) != 0  &&
-                band == (LMIC.channelFreq[chnl] & 0x3) ) { // in selected band
-                LMIC.txChnl = LMIC.bands[band].lastchnl = chnl;
-                return mintime;
-            }
-        }
-        if( (bmap &= ~(1<<band)) == 0 ) {
-            // No feasible channel  found!
-            return mintime;
-        }
-    } while(1);
+    // Channels enabled and usable with the current datarate
+    u2_t drmap = LMIC.channelMap & LMIC.drChnlMap[LMIC.datarate];
+#if defined(ENABLE_CHANNEL_STATS)
+    chnlAvoid(&drmap, 0, 1);
+#endif // ENABLE_CHANNEL_STATS
+    ostime_t mintime = now + /*8h*/sec2osticks(28800);
+    u1_t band = availBand(drmap, &mintime);
+    // Find next channel in given band, wrapping around to the lowest one
+    u2_t map = LMIC.bandChnlMap[band] & drmap;
+    if( map != 0 ) {
+        u2_t next = map & (u2_t)(0xFFFE << LMIC.bands[band].lastchnl);
+        LMIC.txChnl = LMIC.bands[band].lastchnl = os_ctz2(next != 0 ? next : map);
+    }
+    return mintime;
 }
 
 
@@ -678,13 +1231,34 @@ static void setBcnRxParams (void) {
 #define setRx1Params() /*LMIC.freq/rps remain unchanged*/
 
 #if !defined(DISABLE_JOIN)
+#if defined(ENABLE_JOIN_STRATEGY)
+// Two attempts per datarate, on the 868.x and 864.x channels, from the
+// last successful datarate down to SF12
+static dr_t joinDrDefault (u1_t attempt, dr_t lastDr) {
+    if( lastDr > DR_SF7 )
+        lastDr = DR_SF7;
+    if( attempt/2 > lastDr - DR_SF12 )
+        return DR_NONE;
+    return (dr_t)(lastDr - attempt/2);
+}
+#endif // ENABLE_JOIN_STRATEGY
+
 static void initJoinLoop (void) {
     LMIC.txChnl = os_getRndU1() % 3;
     LMIC.adrTxPow = 14;
+#if defined(ENABLE_JOIN_STRATEGY)
+    joinInit();
+    setDrJoin(DRCHG_SET, (JOIN.strategy != 0 ? JOIN.strategy : FUNC_ADDR(joinDrDefault))(0, JOIN.lastDr));
+#else
     setDrJoin(DRCHG_SET, DR_SF7);
+#endif
     initDefaultChannels(1);
     ASSERT((LMIC.opmode & OP_NEXTCHNL)==0);
+#if defined(ENABLE_JOIN_STRATEGY)
+    LMIC.txend = joinTxBeg(LMIC.bands[BAND_MILLI].avail);
+#else
     LMIC.txend = LMIC.bands[BAND_MILLI].avail + rndDelay(8);
+#endif
 }
 
 
@@ -695,6 +1269,9 @@ static ostime_t nextJoinState (void) {
     // If both fail try next lower datarate
     if( ++LMIC.txChnl == 3 )
         LMIC.txChnl = 0;
+#if defined(ENABLE_JOIN_STRATEGY)
+    setDrJoin(DRCHG_NOJACC, joinNextDr(&failed));
+#else
     if( (++LMIC.txCnt & 1) == 0 ) {
         // Lower DR every 2nd try (having tried 868.x and 864.x with the same DR)
         if( LMIC.datarate == DR_SF12 )
@@ -702,6 +1279,7 @@ static ostime_t nextJoinState (void) {
         else
             setDrJoin(DRCHG_NOJACC, decDR((dr_t)LMIC.datarate));
     }
+#endif
     // Clear NEXTCHNL because join state engine controls channel hopping
     LMIC.opmode &= ~OP_NEXTCHNL;
     // Move txend to randomize synchronized concurrent joins.
@@ -709,6 +1287,9 @@ static ostime_t nextJoinState (void) {
     ostime_t time = os_getTime();
     if( time - LMIC.bands[BAND_MILLI].avail < 0 )
         time = LMIC.bands[BAND_MILLI].avail;
+#if defined(ENABLE_JOIN_STRATEGY)
+    LMIC.txend = isTESTMODE() ? time + DNW2_SAFETY_ZONE : joinTxBeg(time + DNW2_SAFETY_ZONE);
+#else
     LMIC.txend = time +
         (isTESTMODE()
          // Avoid collision with JOIN ACCEPT @ SF12 being sent by GW (but we missed it)
@@ -716,6 +1297,7 @@ static ostime_t nextJoinState (void) {
          // Otherwise: randomize join (street lamp case):
          // SF12:255, SF11:127, .., SF7:8secs
          : DNW2_SAFETY_ZONE+rndDelay(255>>LMIC.datarate));
+#endif
     // 1 - triggers EV_JOIN_FAILED event
     return failed;
 }
@@ -752,17 +1334,20 @@ bit_t LMIC_setupChannel (u1_t chidx, u4_t freq, u2_t drmap, s1_t band) {
     LMIC.xchFreq[chidx] = freq;
     LMIC.xchDrMap[chidx] = drmap==0 ? DR_RANGE_MAP(DR_SF10,DR_SF8C) : drmap;
     LMIC.channelMap[chidx>>4] |= (1<<(chidx&0xF));
+    DO_DEVDB(LMIC.channelMap,channelMap);
     return 1;
 }
 
 void LMIC_disableChannel (u1_t channel) {
     if( channel < 72+MAX_XCHANNELS )
         LMIC.channelMap[channel>>4] &= ~(1<<(channel&0xF));
+    DO_DEVDB(LMIC.channelMap,channelMap);
 }
 
 void LMIC_enableChannel (u1_t channel) {
     if( channel < 72+MAX_XCHANNELS )
         LMIC.channelMap[channel>>4] |= (1<<(channel&0xF));
+    DO_DEVDB(LMIC.channelMap,channelMap);
 }
 
 void  LMIC_enableSubBand (u1_t band) {
@@ -800,6 +1385,7 @@ static u1_t mapChannels (u1_t chpage, u2_t chmap) {
             return 0;
         LMIC.channelMap[chpage] = chmap;
     }
+    DO_DEVDB(LMIC.channelMap,channelMap);
     return 1;
 }
 
@@ -825,23 +1411,61 @@ static void updateTx (ostime_t txbeg) {
     }
 }
 
+// Any channel for the given datarate is available right away. Returns 0
+// if no enabled channel supports the datarate.
+static bit_t chnlAvail (dr_t dr, ostime_t* avail) {
+    *avail = os_getTime();
+    if( dr >= DR_SF8C )
+        return (LMIC.channelMap[64/16]&0xFF) != 0;
+    return (LMIC.channelMap[0] | LMIC.channelMap[1] | LMIC.channelMap[2] | LMIC.channelMap[3]) != 0;
+}
+
+#if defined(ENABLE_AIRTIME_BUDGET)
+static bit_t chnlSupportsDr (u1_t chnl, u1_t dr) {
+    if( chnl < 64 )
+        return dr <= DR_SF7;
+    if( chnl < 64+8 )
+        return dr == DR_SF8C;
+    return (LMIC.xchDrMap[chnl-72] & (1<<dr)) != 0;
+}
+#endif // ENABLE_AIRTIME_BUDGET
+
 // US does not have duty cycling - return now as earliest TX time
 #define nextTx(now) (_nextTx(),(now))
 static void _nextTx (void) {
     if( LMIC.chRnd==0 )
         LMIC.chRnd = os_getRndU1() & 0x3F;
     if( LMIC.datarate >= DR_SF8C ) { // 500kHz
-        u1_t map = LMIC.channelMap[64/16]&0xFF;
-        for( u1_t i=0; i<8; i++ ) {
-            if( (map & (1<<(++LMIC.chRnd & 7))) != 0 ) {
-                LMIC.txChnl = 64 + (LMIC.chRnd & 7);
-                return;
-            }
+        u2_t map = LMIC.channelMap[64/16]&0xFF;
+#if defined(ENABLE_CHANNEL_STATS)
+        chnlAvoid(&map, 64/16, 1);
+#endif // ENABLE_CHANNEL_STATS
+        if( map != 0 ) {
+            // Next enabled channel after the current one, wrapping around
+            u1_t cur = LMIC.chRnd & 7;
+            u2_t next = map & (u1_t)(0xFE << cur);
+            u1_t chnl = os_ctz2(next != 0 ? next : map);
+            LMIC.chRnd += ((chnl - cur - 1) & 7) + 1;
+            LMIC.txChnl = 64 + chnl;
+            return;
         }
     } else { // 125kHz
-        for( u1_t i=0; i<64; i++ ) {
-            u1_t chnl = ++LMIC.chRnd & 0x3F;
-            if( (LMIC.channelMap[(chnl >> 4)] & (1<<(chnl & 0xF))) != 0 ) {
+        // Search word-wise, starting at the bit following the current
+        // channel and ending with the lower bits of the same word
+        u1_t cur = LMIC.chRnd & 0x3F;
+        u1_t start = (cur + 1) & 0x3F;
+        u2_t chmap[4];
+        os_copyMem(chmap, LMIC.channelMap, sizeof(chmap));
+#if defined(ENABLE_CHANNEL_STATS)
+        chnlAvoid(chmap, 0, 4);
+#endif // ENABLE_CHANNEL_STATS
+        u2_t map = chmap[start >> 4] & (u2_t)(0xFFFF << (start & 0xF));
+        for( u1_t i=0; i<=4; i++ ) {
+            if( i != 0 )
+                map = chmap[((start >> 4) + i) & 3];
+            if( map != 0 ) {
+                u1_t chnl = ((((start >> 4) + i) & 3) << 4) + os_ctz2(map);
+                LMIC.chRnd += ((chnl - cur - 1) & 0x3F) + 1;
                 LMIC.txChnl = chnl;
                 return;
             }
@@ -868,13 +1492,48 @@ static void setBcnRxParams (void) {
 }
 
 #if !defined(DISABLE_JOIN)
+#if defined(ENABLE_JOIN_STRATEGY)
+// SF7 down to SF10 on a 125kHz channel, each followed by SF8C on a 500kHz
+// channel, from the last successful datarate
+static dr_t joinDrDefault (u1_t attempt, dr_t lastDr) {
+    if( lastDr == DR_SF8C ) {
+        if( attempt == 0 )
+            return DR_SF8C;
+        attempt--;
+    }
+    if( lastDr > DR_SF7 )
+        lastDr = DR_SF7;
+    if( (attempt & 1) != 0 )
+        return DR_SF8C;
+    if( attempt/2 > lastDr - DR_SF10 )
+        return DR_NONE;
+    return (dr_t)(lastDr - attempt/2);
+}
+
+// Channel for the join datarate: random 0..63, or 64..71 for SF8C
+static void joinChnl (void) {
+    if( LMIC.datarate == DR_SF8C )
+        LMIC.txChnl = 64+(LMIC.txChnl&7);
+    else
+        LMIC.txChnl = os_getRndU1() & 0x3F;
+}
+#endif // ENABLE_JOIN_STRATEGY
+
 static void initJoinLoop (void) {
     LMIC.chRnd = 0;
     LMIC.txChnl = 0;
     LMIC.adrTxPow = 20;
     ASSERT((LMIC.opmode & OP_NEXTCHNL)==0);
+#if defined(ENABLE_JOIN_STRATEGY)
+    joinInit();
+    LMIC.txChnl = os_getRndU1() & 0x3F;
+    setDrJoin(DRCHG_SET, (JOIN.strategy != 0 ? JOIN.strategy : FUNC_ADDR(joinDrDefault))(0, JOIN.lastDr));
+    joinChnl();
+    LMIC.txend = joinTxBeg(os_getTime());
+#else
     LMIC.txend = os_getTime();
     setDrJoin(DRCHG_SET, DR_SF7);
+#endif
 }
 
 static ostime_t nextJoinState (void) {
@@ -883,6 +1542,10 @@ static ostime_t nextJoinState (void) {
     //   SF8C        on a random channel 64..71
     //
     u1_t failed = 0;
+#if defined(ENABLE_JOIN_STRATEGY)
+    setDrJoin(DRCHG_SET, joinNextDr(&failed));
+    joinChnl();
+#else
     if( LMIC.datarate != DR_SF8C ) {
         LMIC.txChnl = 64+(LMIC.txChnl&7);
         setDrJoin(DRCHG_SET, DR_SF8C);
@@ -895,7 +1558,11 @@ static ostime_t nextJoinState (void) {
         }
         setDrJoin(DRCHG_SET, dr);
     }
+#endif
     LMIC.opmode &= ~OP_NEXTCHNL;
+#if defined(ENABLE_JOIN_STRATEGY)
+    LMIC.txend = isTESTMODE() ? os_getTime() + DNW2_SAFETY_ZONE : joinTxBeg(os_getTime());
+#else
     LMIC.txend = os_getTime() +
         (isTESTMODE()
          // Avoid collision with JOIN ACCEPT being sent by GW (but we missed it - GW is still busy)
@@ -903,6 +1570,7 @@ static ostime_t nextJoinState (void) {
          // Otherwise: randomize join (street lamp case):
          // SF10:16, SF9=8,..SF8C:1secs
          : rndDelay(16>>LMIC.datarate));
+#endif
     // 1 - triggers EV_JOIN_FAILED event
     return failed;
 }
@@ -922,11 +1590,52 @@ static void runEngineUpdate (xref2osjob_t osjob) {
 }
 
 
+#if defined(ENABLE_EVENT_QUEUE)
+#if !defined(LMIC_EVENT_QUEUE_SIZE)
+#define LMIC_EVENT_QUEUE_SIZE 8
+#endif
+
+// Events not yet taken by the application. This is kept outside of LMIC,
+// so events reported around LMIC_reset() are not lost. Received payloads
+// are copied, since LMIC.frame is reused by the next transaction.
+static struct {
+    evqent_t queue[LMIC_EVENT_QUEUE_SIZE];
+    u1_t first;
+    u1_t count;
+    u2_t lost;   // events dropped because the queue was full
+} EVQ;
+
+
+static void postEvent (ev_t ev) {
+    if( EVQ.count >= LMIC_EVENT_QUEUE_SIZE ) {
+        EVQ.lost += 1;
+        return;
+    }
+    evqent_t* e = &EVQ.queue[(EVQ.first + EVQ.count) % LMIC_EVENT_QUEUE_SIZE];
+    e->time      = os_getTime();
+    e->ev        = ev;
+    e->txrxFlags = LMIC.txrxFlags;
+    e->port      = 0;
+    e->dataLen   = 0;
+    if( (ev == EV_TXCOMPLETE || ev == EV_RXCOMPLETE) && (LMIC.txrxFlags & TXRX_PORT) != 0 ) {
+        e->port    = LMIC.frame[LMIC.dataBeg-1];
+        e->dataLen = LMIC.dataLen;
+        os_copyMem(e->data, LMIC.frame+LMIC.dataBeg, LMIC.dataLen);
+    }
+    EVQ.count += 1;
+}
+#endif // ENABLE_EVENT_QUEUE
+
+
 static void reportEvent (ev_t ev) {
     EV(devCond, INFO, (e_.reason = EV::devCond_t::LMIC_EV,
                        e_.eui    = MAIN::CDEV->getEui(),
                        e_.info   = ev));
+#if defined(ENABLE_EVENT_QUEUE)
+    postEvent(ev);
+#else
     ON_LMIC_EVENT(ev);
+#endif
     engineUpdate();
 }
 
@@ -968,6 +1677,9 @@ static void stateJustJoined (void) {
     LMIC.ping.freq   = FREQ_PING;
     LMIC.ping.dr     = DR_PING;
 #endif
+#if defined(ENABLE_TX_KEYSTREAM)
+    scheduleKeystream();
+#endif
 }
 
 
@@ -1014,6 +1726,134 @@ static int decodeBeacon (void) {
 #endif // !DISABLE_BEACONS
 
 
+#if defined(ENABLE_LINK_ADAPT)
+#if !defined(LMIC_LINK_MINPOW)
+#define LMIC_LINK_MINPOW 2
+#endif
+#if !defined(LMIC_LINK_GWPOW)
+#if defined(CFG_eu868)
+#define LMIC_LINK_GWPOW 27  // RX2 on 869.525MHz
+#elif defined(CFG_us915)
+#define LMIC_LINK_GWPOW 30
+#endif
+#endif
+enum { LINK_REF = -141 };  // link levels are stored relative to this (dBm)
+
+// Pick the fastest datarate, and the lowest TX power on it, which keep the
+// required margin for the weakest link level in the window.
+static void linkAdapt (void) {
+    int lvl = 127;
+    for( u1_t i=0; i<LMIC.lnkCnt; i++ ) {
+        if( LMIC.lnkLevel[i] < lvl )
+            lvl = LMIC.lnkLevel[i];
+    }
+    lvl += LINK_REF - LMIC.lnkMargin;
+
+    dr_t best = DR_NONE, slowest = DR_NONE;
+    ostime_t avail;
+    for( dr_t dr=0; dr<DR_NONE; dr++ ) {
+        rps_t rps = updr2rps(dr);
+        if( getSf(rps) == FSK || !chnlAvail(dr, &avail) )
+            continue;
+        if( slowest == DR_NONE || isSlowerDR(dr, slowest) )
+            slowest = dr;
+        if( lvl >= getSensitivity(rps) && (best == DR_NONE || isFasterDR(dr, best)) )
+            best = dr;
+    }
+    if( slowest == DR_NONE )
+        return;  // no usable channel
+    s1_t pow = LMIC.lnkMaxPow;
+    if( best == DR_NONE ) {
+        best = slowest;
+    } else {
+        // Reduce the power in 2dB steps by the excess margin
+        int excess = lvl - getSensitivity(updr2rps(best));
+        pow = excess >= pow - LMIC_LINK_MINPOW ? LMIC_LINK_MINPOW : pow - (excess & ~1);
+        if( pow > LMIC.lnkMaxPow )
+            pow = LMIC.lnkMaxPow;
+    }
+    if( best != LMIC.datarate || pow != LMIC.adrTxPow )
+        setDrTxpow(DRCHG_SET, best, pow);
+}
+
+// Add a link level (signal strength in dBm as it would be at full TX power)
+// to the window and adapt datarate and power, unless the NWK does ADR.
+static void linkSample (int level) {
+    if( LMIC.lnkMargin == 0 )
+        return;
+    level -= LINK_REF;
+    LMIC.lnkLevel[LMIC.lnkPos] = level < -128 ? -128 : level > 127 ? 127 : level;
+    if( ++LMIC.lnkPos == LMIC_LINK_WINDOW )
+        LMIC.lnkPos = 0;
+    if( LMIC.lnkCnt < LMIC_LINK_WINDOW )
+        LMIC.lnkCnt += 1;
+    if( LMIC.adrEnabled == 0 )
+        linkAdapt();
+}
+
+// Forget the link history and go back to full power, e.g. when the link
+// has been lost.
+static void linkReset (void) {
+    if( LMIC.lnkMargin == 0 )
+        return;
+    LMIC.lnkCnt = LMIC.lnkPos = 0;
+    LMIC.adrTxPow = LMIC.lnkMaxPow;
+}
+#endif // ENABLE_LINK_ADAPT
+
+
+#if defined(ENABLE_RX_HANDLERS)
+// Pass the received payload to the handler registered for port
+static void dispatchRx (u1_t port) {
+    for( u1_t i=0; i<LMIC.rxHandlerCnt; i++ ) {
+        rxport_t* h = &LMIC.rxHandlers[i];
+        if( port >= h->portLo && port <= h->portHi ) {
+            h->handler(port, LMIC.frame+LMIC.dataBeg, LMIC.dataLen,
+                       LMIC.rssi - RSSI_OFF, LMIC.snr / SNR_SCALEUP,
+                       LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2|TXRX_PING|TXRX_MCAST));
+            break;
+        }
+    }
+}
+#endif // ENABLE_RX_HANDLERS
+
+
+#if defined(ENABLE_MULTICAST)
+// Verify and decrypt a frame sent to multicast group gi. Group frames are
+// unconfirmed, carry neither MAC commands nor ACKs and are accepted only
+// outside of TX/RX transactions, i.e. in ping slots and during class C
+// reception. The unicast session is not touched.
+static bit_t decodeMcast (u1_t gi, u4_t seqno, int poff, int pend) {
+    xref2u1_t d = LMIC.frame;
+    mcgroup_t* g = &LMIC.mcGroups[gi];
+    if( (LMIC.opmode & OP_TXRXPEND) != 0 ||
+        (d[OFF_DAT_HDR] & HDR_FTYPE) != HDR_FTYPE_DADN ||
+        (d[OFF_DAT_FCT] & (FCT_ACK|FCT_OPTLEN)) != 0 ||
+        pend <= poff || d[poff] == 0 )
+        return 0;
+    seqno = g->seqnoDn + (u2_t)(seqno - g->seqnoDn);
+    if( seqno < g->seqnoDn ||
+        !aes_verifyMic(g->nwkKey, g->addr, seqno, /*dn*/1, d, pend) )
+        return 0;
+    g->seqnoDn = seqno+1;
+    poff += 1;  // port, left in front of the payload
+    if( pend > poff )
+        aes_cipher(g->artKey, g->addr, seqno, /*dn*/1, d+poff, pend-poff);
+    LMIC.txrxFlags |= TXRX_MCAST|TXRX_PORT;
+    LMIC.rxGroup = gi;
+    LMIC.dataBeg = poff;
+    LMIC.dataLen = pend-poff;
+#if LMIC_DEBUG_LEVEL > 0
+    printf("%lu: Received multicast downlink, group=%d, port=%d\n", os_getTime(), gi, d[poff-1]);
+#endif
+#if defined(ENABLE_RX_HANDLERS)
+    dispatchRx(d[poff-1]);
+#endif // ENABLE_RX_HANDLERS
+    return 1;
+}
+#endif // ENABLE_MULTICAST
+
+
 static bit_t decodeFrame (void) {
     xref2u1_t d = LMIC.frame;
     u1_t hdr    = d[0];
@@ -1046,6 +1886,15 @@ static bit_t decodeFrame (void) {
     int  pend  = dlen-4;  // MIC
 
     if( addr != LMIC.devaddr ) {
+#if defined(ENABLE_MULTICAST)
+        for( u1_t gi=0; gi<LMIC_MCAST_GROUPS; gi++ ) {
+            if( addr != 0 && addr == LMIC.mcGroups[gi].addr ) {
+                if( !decodeMcast(gi, seqno, poff, pend) )
+                    goto norx;
+                return 1;
+            }
+        }
+#endif // ENABLE_MULTICAST
         EV(specCond, WARN, (e_.reason = EV::specCond_t::ALIEN_ADDRESS,
                             e_.eui    = MAIN::CDEV->getEui(),
                             e_.info   = addr,
@@ -1118,6 +1967,15 @@ static bit_t decodeFrame (void) {
     // Process OPTS
     int m = LMIC.rssi - RSSI_OFF - getSensitivity(LMIC.rps);
     LMIC.margin = m < 0 ? 0 : m > 254 ? 254 : m;
+#if defined(ENABLE_LINK_ADAPT)
+    // The SNR margin over the demodulation floor (-7.5dB at SF7, 2.5dB
+    // lower per SF step) may be lower than the RSSI margin in a noisy band.
+    // The gateway transmits with more power than the device, so the level
+    // is scaled to what an uplink at full power would arrive with.
+    int snrm = (LMIC.snr + (20 + 10*getSf(LMIC.rps))) / SNR_SCALEUP;
+    linkSample(getSensitivity(LMIC.rps) + (snrm < m ? snrm : m)
+               + LMIC.lnkMaxPow - LMIC_LINK_GWPOW);
+#endif // ENABLE_LINK_ADAPT
 
     xref2u1_t opts = &d[OFF_DAT_OPTS];
     int oidx = 0;
@@ -1126,6 +1984,13 @@ static bit_t decodeFrame (void) {
         case MCMD_LCHK_ANS: {
             //int gwmargin = opts[oidx+1];
             //int ngws = opts[oidx+2];
+#if defined(ENABLE_LINK_ADAPT)
+            // Margin of the last UP frame, normalized to full TX power.
+            // The sample of this frame may have changed the datarate and
+            // power already, so use those the UP frame was sent with.
+            linkSample(opts[oidx+1] + getSensitivity(updr2rps(LMIC.lnkTxDr))
+                       + LMIC.lnkMaxPow - LMIC.lnkTxPow);
+#endif // ENABLE_LINK_ADAPT
             oidx += 3;
             continue;
         }
@@ -1315,6 +2180,10 @@ static bit_t decodeFrame (void) {
 #if LMIC_DEBUG_LEVEL > 0
     printf("%lu: Received downlink, window=%s, port=%d, ack=%d\n", os_getTime(), window, port, ackup);
 #endif
+#if defined(ENABLE_RX_HANDLERS)
+    if( port > 0 && !replayConf )
+        dispatchRx(port);
+#endif // ENABLE_RX_HANDLERS
     return 1;
 }
 
@@ -1379,7 +2248,7 @@ static void setupRx1 (osjobcb_t func) {
 static void txDone (ostime_t delay, osjobcb_t func) {
 #if !defined(DISABLE_PING)
     if( (LMIC.opmode & (OP_TRACK|OP_PINGABLE|OP_PINGINI)) == (OP_TRACK|OP_PINGABLE) ) {
-        rxschedInit(&LMIC.ping);    // note: reuses LMIC.frame buffer!
+        pingInit();
         LMIC.opmode |= OP_PINGINI;
     }
 #endif // !DISABLE_PING
@@ -1458,8 +2327,9 @@ static bit_t processJoinAccept (void) {
             return 0;
         goto nojoinframe;
     }
-    aes_encrypt(LMIC.frame+1, dlen-1);
-    if( !aes_verifyMic0(LMIC.frame, dlen-4) ) {
+    // already incremented when JOIN REQ got sent off
+    u1_t sesskeys[32];
+    if( !aes_joinAccept(LMIC.frame, dlen, LMIC.devNonce-1, sesskeys) ) {
         EV(specCond, ERR, (e_.reason = EV::specCond_t::JOIN_BAD_MIC,
                            e_.info   = mic));
         goto badframe;
@@ -1488,8 +2358,8 @@ static bit_t processJoinAccept (void) {
         }
     }
 
-    // already incremented when JOIN REQ got sent off
-    aes_sessKeys(LMIC.devNonce-1, &LMIC.frame[OFF_JA_ARTNONCE], LMIC.nwkKey, LMIC.artKey);
+    os_copyMem(LMIC.nwkKey, sesskeys, 16);
+    os_copyMem(LMIC.artKey, sesskeys+16, 16);
     DO_DEVDB(LMIC.netid,   netid);
     DO_DEVDB(LMIC.devaddr, devaddr);
     DO_DEVDB(LMIC.nwkKey,  nwkkey);
@@ -1506,6 +2376,10 @@ static bit_t processJoinAccept (void) {
                                       : EV::joininfo_t::ACCEPT)));
 
     ASSERT((LMIC.opmode & (OP_JOINING|OP_REJOIN))!=0);
+#if defined(ENABLE_JOIN_STRATEGY)
+    if( (LMIC.opmode & OP_REJOIN) == 0 )
+        JOIN.lastDr = LMIC.datarate;
+#endif
     if( (LMIC.opmode & OP_REJOIN) != 0 ) {
         // Lower DR every try below current UP DR
         LMIC.datarate = lowerDR(LMIC.datarate, LMIC.rejoinCnt);
@@ -1516,6 +2390,9 @@ static bit_t processJoinAccept (void) {
     LMIC.dn2Dr = LMIC.frame[OFF_JA_DLSET] & 0x0F;
     LMIC.rxDelay = LMIC.frame[OFF_JA_RXDLY];
     if (LMIC.rxDelay == 0) LMIC.rxDelay = 1;
+#if defined(ENABLE_JOIN_STRATEGY)
+    joinDone();
+#endif
     reportEvent(EV_JOINED);
     return 1;
 }
@@ -1598,87 +2475,262 @@ static void updataDone (xref2osjob_t osjob) {
 // ========================================
 
 
-static void buildDataFrame (void) {
-    bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
-    u1_t dlen = txdata ? LMIC.pendTxLen : 0;
-
-    // Piggyback MAC options
-    // Prioritize by importance
-    int  end = OFF_DAT_OPTS;
+// Piggyback MAC options. Writes the pending MAC command answers to opts,
+// prioritized by importance, leaving out those that do not fit into
+// maxlen bytes. If commit is set, the answers written are considered sent
+// and no longer pending. Returns the number of bytes written.
+static u1_t buildMacOpts (xref2u1_t opts, u1_t maxlen, bit_t commit) {
+    u1_t end = 0;
 #if !defined(DISABLE_PING)
-    if( (LMIC.opmode & (OP_TRACK|OP_PINGABLE)) == (OP_TRACK|OP_PINGABLE) ) {
+    if( (LMIC.opmode & (OP_TRACK|OP_PINGABLE)) == (OP_TRACK|OP_PINGABLE) && end+2 <= maxlen ) {
         // Indicate pingability in every UP frame
-        LMIC.frame[end] = MCMD_PING_IND;
-        LMIC.frame[end+1] = LMIC.ping.dr | (LMIC.ping.intvExp<<4);
+        opts[end] = MCMD_PING_IND;
+        opts[end+1] = LMIC.ping.dr | (LMIC.ping.intvExp<<4);
         end += 2;
     }
 #endif // !DISABLE_PING
 #if !defined(DISABLE_MCMD_DCAP_REQ)
-    if( LMIC.dutyCapAns ) {
-        LMIC.frame[end] = MCMD_DCAP_ANS;
+    if( LMIC.dutyCapAns && end+1 <= maxlen ) {
+        opts[end] = MCMD_DCAP_ANS;
         end += 1;
-        LMIC.dutyCapAns = 0;
+        if( commit )
+            LMIC.dutyCapAns = 0;
     }
 #endif // !DISABLE_MCMD_DCAP_REQ
 #if !defined(DISABLE_MCMD_DN2P_SET)
-    if( LMIC.dn2Ans ) {
-        LMIC.frame[end+0] = MCMD_DN2P_ANS;
-        LMIC.frame[end+1] = LMIC.dn2Ans & ~MCMD_DN2P_ANS_RFU;
+    if( LMIC.dn2Ans && end+2 <= maxlen ) {
+        opts[end+0] = MCMD_DN2P_ANS;
+        opts[end+1] = LMIC.dn2Ans & ~MCMD_DN2P_ANS_RFU;
         end += 2;
-        LMIC.dn2Ans = 0;
+        if( commit )
+            LMIC.dn2Ans = 0;
     }
 #endif // !DISABLE_MCMD_DN2P_SET
-    if( LMIC.devsAns ) {  // answer to device status
-        LMIC.frame[end+0] = MCMD_DEVS_ANS;
-        LMIC.frame[end+1] = os_getBattLevel();
-        LMIC.frame[end+2] = LMIC.margin;
+    if( LMIC.devsAns && end+3 <= maxlen ) {  // answer to device status
+        opts[end+0] = MCMD_DEVS_ANS;
+        opts[end+1] = os_getBattLevel();
+        opts[end+2] = LMIC.margin;
         end += 3;
-        LMIC.devsAns = 0;
+        if( commit )
+            LMIC.devsAns = 0;
     }
-    if( LMIC.ladrAns ) {  // answer to ADR change
-        LMIC.frame[end+0] = MCMD_LADR_ANS;
-        LMIC.frame[end+1] = LMIC.ladrAns & ~MCMD_LADR_ANS_RFU;
+    if( LMIC.ladrAns && end+2 <= maxlen ) {  // answer to ADR change
+        opts[end+0] = MCMD_LADR_ANS;
+        opts[end+1] = LMIC.ladrAns & ~MCMD_LADR_ANS_RFU;
         end += 2;
-        LMIC.ladrAns = 0;
+        if( commit )
+            LMIC.ladrAns = 0;
     }
 #if !defined(DISABLE_BEACONS)
-    if( LMIC.bcninfoTries > 0 ) {
-        LMIC.frame[end] = MCMD_BCNI_REQ;
+    if( LMIC.bcninfoTries > 0 && end+1 <= maxlen ) {
+        opts[end] = MCMD_BCNI_REQ;
         end += 1;
     }
 #endif // !DISABLE_BEACONS
-    if( LMIC.adrChanged ) {
+    if( commit && LMIC.adrChanged ) {
         if( LMIC.adrAckReq < 0 )
             LMIC.adrAckReq = 0;
         LMIC.adrChanged = 0;
     }
 #if !defined(DISABLE_MCMD_PING_SET) && !defined(DISABLE_PING)
-    if( LMIC.pingSetAns != 0 ) {
-        LMIC.frame[end+0] = MCMD_PING_ANS;
-        LMIC.frame[end+1] = LMIC.pingSetAns & ~MCMD_PING_ANS_RFU;
+    if( LMIC.pingSetAns != 0 && end+2 <= maxlen ) {
+        opts[end+0] = MCMD_PING_ANS;
+        opts[end+1] = LMIC.pingSetAns & ~MCMD_PING_ANS_RFU;
         end += 2;
-        LMIC.pingSetAns = 0;
+        if( commit )
+            LMIC.pingSetAns = 0;
     }
 #endif // !DISABLE_MCMD_PING_SET && !DISABLE_PING
 #if !defined(DISABLE_MCMD_SNCH_REQ)
-    if( LMIC.snchAns ) {
-        LMIC.frame[end+0] = MCMD_SNCH_ANS;
-        LMIC.frame[end+1] = LMIC.snchAns & ~MCMD_SNCH_ANS_RFU;
+    if( LMIC.snchAns && end+2 <= maxlen ) {
+        opts[end+0] = MCMD_SNCH_ANS;
+        opts[end+1] = LMIC.snchAns & ~MCMD_SNCH_ANS_RFU;
         end += 2;
-        LMIC.snchAns = 0;
+        if( commit )
+            LMIC.snchAns = 0;
     }
 #endif // !DISABLE_MCMD_SNCH_REQ
-    ASSERT(end <= OFF_DAT_OPTS+16);
+    ASSERT(end <= FCT_OPTLEN);
+    return end;
+}
 
-    u1_t flen = end + (txdata ? 5+dlen : 4);
-    if( flen > MAX_LEN_FRAME ) {
-        // Options and payload too big - delay payload
-        txdata = 0;
-        flen = end+4;
-    }
-    LMIC.frame[OFF_DAT_HDR] = HDR_FTYPE_DAUP | HDR_MAJOR_V1;
-    LMIC.frame[OFF_DAT_FCT] = (LMIC.dnConf | LMIC.adrEnabled
-                              | (LMIC.adrAckReq >= 0 ? FCT_ADRARQ : 0)
+
+// Space for the payload of a data frame at the current datarate, with
+// the port byte at offset end, i.e. after any MAC options.
+static int maxPayload (int end) {
+    int limit = maxFrameLen(LMIC.datarate);
+    if( limit > MAX_LEN_FRAME )
+        limit = MAX_LEN_FRAME;
+    return limit - (end + 5);   // port and MIC
+}
+
+
+// Length of a data frame with the given payload and the MAC options
+// currently pending, before checking it against the datarate.
+static int dataFrameLen (bit_t txdata, u1_t dlen) {
+    u1_t opts[FCT_OPTLEN];
+    return OFF_DAT_OPTS + buildMacOpts(opts, FCT_OPTLEN, 0) + (txdata ? 5+dlen : 4);
+}
+
+
+#if defined(ENABLE_TX_QUEUE)
+static void txqRemove (u1_t idx) {
+    LMIC.txqLen -= 1;
+    memmove(&LMIC.txq[idx], &LMIC.txq[idx+1], (LMIC.txqLen-idx) * sizeof(LMIC.txq[0]));
+}
+
+
+// Drop all queued messages whose expiry has passed.
+static void txqExpire (ostime_t now) {
+    u1_t i = 0;
+    while( i < LMIC.txqLen ) {
+        if( (LMIC.txq[i].flags & TXQ_EXPIRES) != 0 && now - LMIC.txq[i].expiry >= 0 ) {
+            txqRemove(i);
+            continue;
+        }
+        i++;
+    }
+}
+
+
+// Write a queued message to the start of pendTxData, framed if a framer
+// is set. Returns its length, or -1 if it does not fit into limit bytes.
+static int txqFrame (txqmsg_t* m, int limit) {
+    if( limit < 0 )
+        return -1;
+#if defined(ENABLE_TX_AGGREGATE)
+    if( LMIC.txFramer != 0 ) {
+        u1_t n = LMIC.txFramer(LMIC.pendTxData, limit, m->data, m->len);
+        return n != 0 ? n : -1;
+    }
+#endif // ENABLE_TX_AGGREGATE
+    if( m->len > limit )
+        return -1;
+    os_copyMem(LMIC.pendTxData, m->data, m->len);
+    return m->len;
+}
+
+
+// Index of the first queued message of the highest priority among those
+// that fit into limit bytes, or -1 if none does. Only used while no
+// application data is pending, since this overwrites pendTxData.
+static int txqBest (int limit) {
+    int best = -1;
+    for( u1_t i=0; i<LMIC.txqLen; i++ ) {
+        if( best >= 0 && LMIC.txq[i].prio <= LMIC.txq[best].prio )
+            continue;
+        if( txqFrame(&LMIC.txq[i], limit) >= 0 )
+            best = i;
+    }
+    return best;
+}
+
+
+// Move the first message of the highest priority that fits into a frame
+// at the current datarate into the pending TX slot. Messages that do not
+// fit stay queued until the datarate allows them or they expire. Returns
+// 0 if no such message is left.
+static bit_t txqPop (ostime_t now) {
+    txqExpire(now);
+    int limit = maxPayload(dataFrameLen(1, 0) - 5);
+    int best = txqBest(limit);
+    if( best < 0 )
+        return 0;
+    txqmsg_t* m = &LMIC.txq[best];
+    LMIC.pendTxLen = txqFrame(m, limit);
+#if defined(ENABLE_TX_AGGREGATE)
+    LMIC.txqAggr = (LMIC.txFramer != 0);
+#endif // ENABLE_TX_AGGREGATE
+#if defined(ENABLE_TX_INPLACE)
+    LMIC.txInplace = 0;
+#endif
+    LMIC.pendTxPort = m->port;
+    LMIC.pendTxConf = (m->flags & TXQ_CONFIRMED) != 0;
+    txqRemove(best);
+    return 1;
+}
+
+
+#if defined(ENABLE_TX_AGGREGATE)
+// Append further queued messages for the same port and confirmation
+// mode to the framed message in pendTxData, in order of priority, as far
+// as they fit into a frame at the current datarate. end is the offset of
+// the port byte in the frame, i.e. after any MAC options.
+static void txqAggregate (int end) {
+    int limit = maxPayload(end);
+    u4_t tried = 0, taken = 0;
+    for(;;) {
+        int best = -1;
+        for( u1_t i=0; i<LMIC.txqLen; i++ ) {
+            txqmsg_t* m = &LMIC.txq[i];
+            if( (tried & ((u4_t)1<<i)) != 0 || m->port != LMIC.pendTxPort ||
+                ((m->flags & TXQ_CONFIRMED) != 0) != (LMIC.pendTxConf != 0) )
+                continue;
+            if( best < 0 || m->prio > LMIC.txq[best].prio )
+                best = i;
+        }
+        if( best < 0 || LMIC.pendTxLen >= limit )
+            break;
+        tried |= (u4_t)1<<best;
+        txqmsg_t* m = &LMIC.txq[best];
+        u1_t n = LMIC.txFramer(LMIC.pendTxData+LMIC.pendTxLen, limit-LMIC.pendTxLen, m->data, m->len);
+        if( n != 0 ) {
+            LMIC.pendTxLen += n;
+            taken |= (u4_t)1<<best;
+        }
+    }
+    for( int i=LMIC.txqLen-1; i>=0; i-- ) {
+        if( (taken & ((u4_t)1<<i)) != 0 )
+            txqRemove(i);
+    }
+}
+#endif // ENABLE_TX_AGGREGATE
+#endif // ENABLE_TX_QUEUE
+
+
+static void buildDataFrame (void) {
+    bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
+    u1_t dlen = txdata ? LMIC.pendTxLen : 0;
+
+    // Only include the options that leave room for the payload, the
+    // others are sent with a later frame. The payload itself always fits,
+    // see engineUpdate().
+    int  end = OFF_DAT_OPTS;
+    int  maxopts = maxPayload(OFF_DAT_OPTS) + (txdata ? -dlen : 1);
+    if( maxopts < 0 )
+        maxopts = 0;
+    if( maxopts > FCT_OPTLEN )
+        maxopts = FCT_OPTLEN;
+#if defined(ENABLE_TX_INPLACE)
+    if( LMIC.txInplace != 0 && txdata ) {
+        // The application wrote the payload into the frame already. Move
+        // it if the options changed since LMIC_getTxBuffer().
+        u1_t opts[FCT_OPTLEN];
+        end += buildMacOpts(opts, maxopts, 1);
+        if( end != LMIC.txInplace )
+            memmove(LMIC.frame+end+1, LMIC.frame+LMIC.txInplace+1, dlen);
+        os_copyMem(LMIC.frame+OFF_DAT_OPTS, opts, end-OFF_DAT_OPTS);
+    } else
+#endif // ENABLE_TX_INPLACE
+    {
+        end += buildMacOpts(LMIC.frame+OFF_DAT_OPTS, maxopts, 1);
+    }
+
+#if defined(ENABLE_TX_AGGREGATE)
+    if( LMIC.txqAggr ) {
+        LMIC.txqAggr = 0;
+        if( txdata && LMIC.txCnt == 0 ) {
+            txqAggregate(end);
+            dlen = LMIC.pendTxLen;
+        }
+    }
+#endif // ENABLE_TX_AGGREGATE
+
+    int  flen = end + (txdata ? 5+dlen : 4);
+    ASSERT(flen <= MAX_LEN_FRAME && flen <= maxFrameLen(LMIC.datarate));
+    LMIC.frame[OFF_DAT_HDR] = HDR_FTYPE_DAUP | HDR_MAJOR_V1;
+    LMIC.frame[OFF_DAT_FCT] = (LMIC.dnConf | LMIC.adrEnabled
+                              | (LMIC.adrAckReq >= 0 ? FCT_ADRARQ : 0)
                               | (end-OFF_DAT_OPTS));
     os_wlsbf4(LMIC.frame+OFF_DAT_ADDR,  LMIC.devaddr);
 
@@ -1705,10 +2757,24 @@ static void buildDataFrame (void) {
             if( LMIC.txCnt == 0 ) LMIC.txCnt = 1;
         }
         LMIC.frame[end] = LMIC.pendTxPort;
-        os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
-        aes_cipher(LMIC.pendTxPort==0 ? LMIC.nwkKey : LMIC.artKey,
-                   LMIC.devaddr, LMIC.seqnoUp-1,
-                   /*up*/0, LMIC.frame+end+1, dlen);
+        xref2u1_t payload = LMIC.pendTxData;
+#if defined(ENABLE_TX_INPLACE)
+        if( LMIC.txInplace != 0 )
+            payload = LMIC.frame+end+1;
+#endif // ENABLE_TX_INPLACE
+#if defined(ENABLE_TX_KEYSTREAM)
+        if( LMIC.pendTxPort != 0 && LMIC.ksValid && LMIC.ksSeqno == LMIC.seqnoUp-1 ) {
+            for( u1_t i=0; i<dlen; i++ )
+                LMIC.frame[end+1+i] = payload[i] ^ LMIC.keystream[i];
+        } else
+#endif // ENABLE_TX_KEYSTREAM
+        {
+            if( payload != LMIC.frame+end+1 )
+                os_copyMem(LMIC.frame+end+1, payload, dlen);
+            aes_cipher(LMIC.pendTxPort==0 ? LMIC.nwkKey : LMIC.artKey,
+                       LMIC.devaddr, LMIC.seqnoUp-1,
+                       /*up*/0, LMIC.frame+end+1, dlen);
+        }
     }
     aes_appendMic(LMIC.nwkKey, LMIC.devaddr, LMIC.seqnoUp-1, /*up*/0, LMIC.frame, flen-4);
 
@@ -1724,16 +2790,97 @@ static void buildDataFrame (void) {
                        e_.opts.length = end-LORA::OFF_DAT_OPTS,
                        memcpy(&e_.opts[0], LMIC.frame+LORA::OFF_DAT_OPTS, end-LORA::OFF_DAT_OPTS)));
     LMIC.dataLen = flen;
+#if defined(ENABLE_TX_INPLACE)
+    LMIC.txInplace = 0;
+#endif
 }
 
 
+#if defined(ENABLE_CLASS_C)
+//! \brief Enable or disable class C operation. While enabled, the radio
+//! receives on the RX2 frequency and datarate (LMIC.dn2Freq, LMIC.dn2Dr)
+//! whenever no TX/RX transaction is in progress, also while waiting for
+//! a deferred transmission. Received frames are reported with
+//! EV_RXCOMPLETE and the TXRX_DNW2 flag. Class C is only active with a
+//! session and cannot be combined with beacon tracking.
+//! \return 0 if class C cannot be enabled since beacon tracking is active.
+bit_t LMIC_setClassC (bit_t enabled) {
+    if( enabled ) {
+        if( (LMIC.opmode & (OP_SCAN|OP_TRACK)) != 0 )
+            return 0;
+        LMIC.opmode |= OP_CLASSC;
+    } else {
+        LMIC.opmode &= ~OP_CLASSC;
+    }
+    // Without a session there is no reception to start or stop, and the
+    // engine would start joining
+    if( LMIC.devaddr != 0 )
+        engineUpdate();
+    return 1;
+}
+#endif // ENABLE_CLASS_C
+
+
 #if !defined(DISABLE_BEACONS)
+#if defined(ENABLE_TIMED_SCAN)
+// Beacon arrival windows are scanned in slices of the error range, which
+// leave room for the beacon airtime so the windows of consecutive slices
+// do not overlap.
+enum { SCAN_SLICE_ms = BCN_INTV_ms - BCN_RESERVE_ms };
+
+static void onBcnRx (xref2osjob_t job);
+
+static void startScanRx (xref2osjob_t job) {
+    if( (LMIC.opmode & OP_SCAN) == 0 )
+        return;  // tracking was disabled meanwhile
+    setBcnRxParams();
+    os_radio(RADIO_RXON);
+    os_setTimedCallback(&LMIC.osjob, LMIC.bcninfo.txtime, FUNC_ADDR(onBcnRx));
+}
+
+// Listen for a beacon in the next slice of the error range. The real GPS
+// time at scanRef is scanGps plus e ms, with |e| <= scanErr. A beacon sent
+// at GPS time t then arrives at scanRef + t - scanGps - e, so each slice of
+// possible values of e is covered by a window of the same length before a
+// single beacon. On US915 the window is on the channel of that beacon,
+// which follows from its time, as the channel advances with each beacon
+// period. Returns 0 if the whole error range has been scanned.
+static bit_t scanWindow (void) {
+    s4_t err = LMIC.scanErr;
+    s4_t lo  = (s4_t)LMIC.scanSlice * SCAN_SLICE_ms - err;
+    if( lo >= err )
+        return 0;
+    s4_t hi = lo + SCAN_SLICE_ms;
+    if( hi > err )
+        hi = err;
+    // First beacon whose window has not yet started
+    s4_t ms = osticks2ms(os_getTime() + RX_RAMPUP - LMIC.scanRef) + hi;
+    u4_t t  = LMIC.scanGps + (ms >= 0 ? (ms+999)/1000 : -(-ms/1000));
+    t = (t + BCN_INTV_sec-1) & ~(u4_t)(BCN_INTV_sec-1);
+    ostime_t txtime = LMIC.scanRef + sec2osticks((s4_t)(t - LMIC.scanGps));
+#if CFG_us915
+    LMIC.bcnChnl = (t >> BCN_INTV_exp) & 7;
+#endif
+    LMIC.rxtime = txtime - ms2osticks(hi);
+    // Scan ends once a beacon sent at the end of the window is complete
+    LMIC.bcninfo.txtime = txtime - ms2osticks(lo) + AIRTIME_BCN_osticks + RX_RAMPUP;
+    os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, FUNC_ADDR(startScanRx));
+    return 1;
+}
+#endif // ENABLE_TIMED_SCAN
+
 // Callback from HAL during scan mode or when job timer expires.
 static void onBcnRx (xref2osjob_t job) {
     // If we arrive via job timer make sure to put radio to rest.
     os_radio(RADIO_RST);
     os_clearCallback(&LMIC.osjob);
     if( LMIC.dataLen == 0 ) {
+#if defined(ENABLE_TIMED_SCAN)
+        // Nothing in this window - try the next part of the error range
+        LMIC.scanSlice++;
+        if( LMIC.scanErr != 0 && scanWindow() )
+            return;
+#endif
         // Nothing received - timeout
         LMIC.opmode &= ~(OP_SCAN | OP_TRACK);
         reportEvent(EV_SCAN_TIMEOUT);
@@ -1750,6 +2897,13 @@ static void onBcnRx (xref2osjob_t job) {
     // We don't have a previous beacon to calc some drift - assume
     // an max error of 13ms = 128sec*100ppm which is roughly +/-100ppm
     calcBcnRxWindowFromMillis(13,1);
+#if defined(ENABLE_DRIFT_MODEL)
+    driftSample(1);
+#endif
+#if CFG_us915
+    // Next beacon is sent on the next channel (see processBeacon)
+    LMIC.bcnChnl = (LMIC.bcnChnl+1) & 7;
+#endif
     LMIC.opmode &= ~OP_SCAN;          // turn SCAN off
     LMIC.opmode |=  OP_TRACK;         // auto enable tracking
     reportEvent(EV_BEACON_FOUND);    // can be disabled in callback
@@ -1768,6 +2922,11 @@ static void startScan (void) {
     // Cancel onging TX/RX transaction
     LMIC.txCnt = LMIC.dnConf = LMIC.bcninfo.flags = 0;
     LMIC.opmode = (LMIC.opmode | OP_SCAN) & ~(OP_TXRXPEND);
+#if defined(ENABLE_TIMED_SCAN)
+    LMIC.scanSlice = 0;
+    if( LMIC.scanErr != 0 && scanWindow() )
+        return;
+#endif
     setBcnRxParams();
     LMIC.rxtime = LMIC.bcninfo.txtime = os_getTime() + sec2osticks(BCN_INTV_sec+1);
     os_setTimedCallback(&LMIC.osjob, LMIC.rxtime, FUNC_ADDR(onBcnRx));
@@ -1776,16 +2935,65 @@ static void startScan (void) {
 
 
 bit_t LMIC_enableTracking (u1_t tryBcnInfo) {
-    if( (LMIC.opmode & (OP_SCAN|OP_TRACK|OP_SHUTDOWN)) != 0 )
+    if( (LMIC.opmode & (OP_SCAN|OP_TRACK|OP_SHUTDOWN|OP_CLASSC)) != 0 )
         return 0;  // already in progress or failed to enable
     // If BCN info requested from NWK then app has to take are
     // of sending data up so that MCMD_BCNI_REQ can be attached.
+#if defined(ENABLE_TIMED_SCAN)
+    LMIC.scanErr = 0;
+#endif
     if( (LMIC.bcninfoTries = tryBcnInfo) == 0 )
         startScan();
     return 1;  // enabled
 }
 
 
+#if defined(ENABLE_TIMED_SCAN)
+//! \brief Enable beacon tracking, starting from an estimate of the GPS time.
+//! The receiver is only turned on when a beacon can arrive according to
+//! the estimate, on the channel of that beacon. This mode ends with the
+//! same events as LMIC_enableTracking(). With a large error, a plain scan
+//! of one beacon period is done instead.
+//! \param gpsTime current GPS time in seconds, or 0 to continue from the
+//! last beacon received, or else from the estimate of the previous call.
+//! \param errMs maximum error of gpsTime in milliseconds, including its
+//! rounding to seconds. An error of 100ppm for the time passed since the
+//! estimate was made is added, which should not be more than a few hours.
+//! \return 0 if tracking is in progress or could not be enabled.
+bit_t LMIC_enableTrackingAt (u4_t gpsTime, u4_t errMs) {
+    if( (LMIC.opmode & (OP_SCAN|OP_TRACK|OP_SHUTDOWN|OP_CLASSC)) != 0 )
+        return 0;  // already in progress or failed to enable
+    if( gpsTime != 0 ) {
+        LMIC.scanRef = os_getTime();
+        LMIC.scanGps = gpsTime;
+    } else if( (LMIC.bcninfo.flags & (BCN_PARTIAL|BCN_FULL)) != 0 ) {
+        // Last beacon - if it was missed its time is off by up to 13ms
+        // per beacon missed (128sec*100ppm)
+        LMIC.scanRef = LMIC.bcninfo.txtime;
+        LMIC.scanGps = LMIC.bcninfo.time;
+        errMs += 13 * LMIC.missedBcns;
+    } else if( LMIC.scanErr != 0 ) {
+        errMs += LMIC.scanErr;
+    } else {
+        return LMIC_enableTracking(0);
+    }
+    errMs += osticks2ms(os_getTime() - LMIC.scanRef) / 10000 + 1;
+#if CFG_us915
+    // Slices on more than all 8 channels take longer than a plain scan
+    // is expected to take
+    if( errMs >= 4*SCAN_SLICE_ms )
+#else
+    if( errMs >= BCN_INTV_ms/2 )
+#endif
+        return LMIC_enableTracking(0);
+    LMIC.bcninfoTries = 0;
+    LMIC.scanErr = errMs;
+    startScan();
+    return 1;  // enabled
+}
+#endif // ENABLE_TIMED_SCAN
+
+
 void LMIC_disableTracking (void) {
     LMIC.opmode &= ~(OP_SCAN|OP_TRACK);
     LMIC.bcninfoTries = 0;
@@ -1808,6 +3016,10 @@ static void buildJoinRequest (u1_t ftype) {
     d[OFF_JR_HDR] = ftype;
     os_getArtEui(d + OFF_JR_ARTEUI);
     os_getDevEui(d + OFF_JR_DEVEUI);
+#if defined(ENABLE_JOIN_STRATEGY)
+    joinInit();
+    LMIC.devNonce = JOIN.nonce;
+#endif
     os_wlsbf2(d + OFF_JR_DEVNONCE, LMIC.devNonce);
     aes_appendMic0(d, OFF_JR_MIC);
 
@@ -1822,6 +3034,9 @@ static void buildJoinRequest (u1_t ftype) {
     LMIC.dataLen = LEN_JR;
     LMIC.devNonce++;
     DO_DEVDB(LMIC.devNonce,devNonce);
+#if defined(ENABLE_JOIN_STRATEGY)
+    joinSent();
+#endif
 }
 
 static void startJoining (xref2osjob_t osjob) {
@@ -1847,6 +3062,32 @@ bit_t LMIC_startJoining (void) {
     }
     return 0; // already joined
 }
+
+
+#if defined(ENABLE_JOIN_STRATEGY)
+//! \brief Set the function choosing the datarate of each join attempt.
+//! It is called with the attempt number, counting from 0, and the
+//! datarate of the last successful join, or DR_NONE if unknown, and
+//! returns DR_NONE once all attempts failed. Then EV_JOIN_FAILED is
+//! reported and joining starts over at attempt 0 with DR_NONE. The
+//! default tries each datarate twice, from the last successful one
+//! (or SF7) down to SF12, on US915 alternating with SF8C.
+//! Unlike most settings, this is kept by LMIC_reset().
+//! \param strategy the function, or 0 for the default.
+void LMIC_setJoinStrategy (joinstrategy_t strategy) {
+    JOIN.strategy = strategy;
+}
+
+
+//! \brief Limit the total airtime of join requests. Join requests are
+//! spaced like with a duty cycle of capMs per hour, on top of the random
+//! backoff. The default is LMIC_JOIN_AIRTIME_ms. Unlike most settings,
+//! this is kept by LMIC_reset().
+//! \param capMs join airtime per hour in milliseconds, or 0 for no limit.
+void LMIC_setJoinAirtime (u4_t capMs) {
+    JOIN.capMs = capMs;
+}
+#endif // ENABLE_JOIN_STRATEGY
 #endif // !DISABLE_JOIN
 
 
@@ -1871,12 +3112,69 @@ static void processPingRx (xref2osjob_t osjob) {
 #endif // !DISABLE_PING
 
 
+#if defined(ENABLE_CLASS_C)
+static void processRxC (xref2osjob_t osjob);
+
+// Listen on the RX2 frequency and datarate until a frame arrives. If
+// deadline is not 0, processRxC is also called at that time, e.g. to start
+// a deferred transmission.
+static void startRxC (ostime_t deadline) {
+    LMIC.rps = dndr2rps(LMIC.dn2Dr);
+    LMIC.freq = LMIC.dn2Freq;
+    LMIC.dataLen = 0;
+    LMIC.rxtime = os_getTime();
+    LMIC.rxcActive = 1;
+    if( deadline != 0 ) {
+        os_setTimedCallback(&LMIC.osjob, deadline, FUNC_ADDR(processRxC));
+    } else {
+        os_clearCallback(&LMIC.osjob);
+        LMIC.osjob.func = FUNC_ADDR(processRxC);
+    }
+    os_radio(RADIO_RXON);
+}
+
+// Stop class C reception to make the radio available. Returns 0 if a frame
+// has been received and still has to be processed by processRxC.
+static bit_t stopRxC (void) {
+    if( !LMIC.rxcActive )
+        return 1;
+    hal_disableIRQs();
+    bit_t idle = LMIC.dataLen == 0;
+    if( idle ) {
+        os_radio(RADIO_RST);
+        os_clearCallback(&LMIC.osjob);
+        LMIC.rxcActive = 0;
+    }
+    hal_enableIRQs();
+    return idle;
+}
+
+// Called when a frame was received during class C reception or when the
+// deadline given to startRxC has passed.
+static void processRxC (xref2osjob_t osjob) {
+    os_radio(RADIO_RST);
+    LMIC.rxcActive = 0;
+    if( LMIC.dataLen != 0 ) {
+        LMIC.txrxFlags = TXRX_DNW2;
+        if( decodeFrame() ) {
+            reportEvent(EV_RXCOMPLETE);
+            return;
+        }
+    }
+    engineUpdate();
+}
+#endif // ENABLE_CLASS_C
+
+
 static bit_t processDnData (void) {
     ASSERT((LMIC.opmode & OP_TXRXPEND)!=0);
 
     if( LMIC.dataLen == 0 ) {
       norx:
         if( LMIC.txCnt != 0 ) {
+#if defined(ENABLE_CHANNEL_STATS)
+            chnlResult(0);
+#endif // ENABLE_CHANNEL_STATS
             if( LMIC.txCnt < TXCONF_ATTEMPTS ) {
                 LMIC.txCnt += 1;
                 setDrTxpow(DRCHG_NOACK, lowerDR(LMIC.datarate, TABLE_GET_U1(DRADJUST, LMIC.txCnt)), KEEP_TXPOW);
@@ -1896,6 +3194,9 @@ static bit_t processDnData (void) {
         LMIC.dataBeg = LMIC.dataLen = 0;
       txcomplete:
         LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND);
+#if defined(ENABLE_TX_KEYSTREAM)
+        scheduleKeystream();
+#endif
         if( (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2|TXRX_PING)) != 0  &&  (LMIC.opmode & OP_LINKDEAD) != 0 ) {
             LMIC.opmode &= ~OP_LINKDEAD;
             reportEvent(EV_LINK_ALIVE);
@@ -1909,6 +3210,9 @@ static bit_t processDnData (void) {
             EV(devCond, ERR, (e_.reason = EV::devCond_t::LINK_DEAD,
                               e_.eui    = MAIN::CDEV->getEui(),
                               e_.info   = LMIC.adrAckReq));
+#if defined(ENABLE_LINK_ADAPT)
+            linkReset();
+#endif // ENABLE_LINK_ADAPT
             setDrTxpow(DRCHG_NOADRACK, decDR((dr_t)LMIC.datarate), KEEP_TXPOW);
             LMIC.adrAckReq = LINK_CHECK_CONT;
             LMIC.opmode |= OP_REJOIN|OP_LINKDEAD;
@@ -1933,6 +3237,9 @@ static bit_t processDnData (void) {
             return 0;
         goto norx;
     }
+#if defined(ENABLE_CHANNEL_STATS)
+    chnlResult(1);
+#endif // ENABLE_CHANNEL_STATS
     goto txcomplete;
 }
 
@@ -1945,6 +3252,9 @@ static void processBeacon (xref2osjob_t osjob) {
 
     if( LMIC.dataLen != 0 && decodeBeacon() >= 1 ) {
         ev = EV_BEACON_TRACKED;
+#if defined(ENABLE_DRIFT_MODEL)
+        driftSample(LMIC.missedBcns+1);
+#endif
         if( (flags & (BCN_PARTIAL|BCN_FULL)) == 0 ) {
             // We don't have a previous beacon to calc some drift - assume
             // an max error of 13ms = 128sec*100ppm which is roughly +/-100ppm
@@ -1977,6 +3287,11 @@ static void processBeacon (xref2osjob_t osjob) {
         LMIC.bcninfo.txtime += BCN_INTV_osticks - LMIC.drift;
         LMIC.bcninfo.time   += BCN_INTV_sec;
         LMIC.missedBcns++;
+#if defined(ENABLE_DRIFT_MODEL)
+        ostime_t off, bound;
+        if( driftPredict(LMIC.missedBcns, &off, &bound) )
+            LMIC.bcninfo.txtime = LMIC.dmRef + LMIC.missedBcns * BCN_INTV_osticks + off;
+#endif
         // Delay any possible TX after surmised beacon - it's there although we missed it
         txDelay(LMIC.bcninfo.txtime + BCN_RESERVE_osticks, 4);
         if( LMIC.missedBcns > MAX_MISSED_BCNS )
@@ -1989,13 +3304,16 @@ static void processBeacon (xref2osjob_t osjob) {
     }
     LMIC.bcnRxtime = LMIC.bcninfo.txtime + BCN_INTV_osticks - calcRxWindow(0,DR_BCN);
     LMIC.bcnRxsyms = LMIC.rxsyms;
+#if defined(ENABLE_DRIFT_MODEL)
+    driftWindow();
+#endif
   rev:
 #if CFG_us915
     LMIC.bcnChnl = (LMIC.bcnChnl+1) & 7;
 #endif
 #if !defined(DISABLE_PING)
     if( (LMIC.opmode & OP_PINGINI) != 0 )
-        rxschedInit(&LMIC.ping);  // note: reuses LMIC.frame buffer!
+        pingInit();
 #endif // !DISABLE_PING
     reportEvent(ev);
 }
@@ -2017,6 +3335,141 @@ static void startRxPing (xref2osjob_t osjob) {
 
 
 // Decide what to do next for the MAC layer of a device
+#if defined(ENABLE_AIRTIME_BUDGET)
+#if !defined(LMIC_BUDGET_BUCKETS)
+#define LMIC_BUDGET_BUCKETS 12
+#endif
+
+// Airtime used within the budget window, in buckets of 1/LMIC_BUDGET_BUCKETS
+// of the window. This is kept outside of LMIC, so the budget also covers
+// transmissions from before an LMIC_reset(), e.g. repeated joins.
+static struct {
+    osjob_t  job;
+    ostime_t bucketLen;   // 0 if no budget is set
+    ostime_t bucketEnd;   // end of the current bucket
+    u4_t     budget;
+    u4_t     used;        // sum of all buckets
+    u4_t     buckets[LMIC_BUDGET_BUCKETS];
+    u1_t     cur;         // current bucket
+    u1_t     policy;
+} BUDGET;
+
+
+// Start a new bucket, dropping the oldest one from the window.
+static void budgetShift (void) {
+    if( ++BUDGET.cur == LMIC_BUDGET_BUCKETS )
+        BUDGET.cur = 0;
+    BUDGET.used -= BUDGET.buckets[BUDGET.cur];
+    BUDGET.buckets[BUDGET.cur] = 0;
+}
+
+// Drop the buckets which have left the window.
+static void budgetRoll (ostime_t now) {
+    while( now - BUDGET.bucketEnd >= 0 ) {
+        budgetShift();
+        BUDGET.bucketEnd += BUDGET.bucketLen;
+    }
+}
+
+
+// Roll the window at the end of each bucket, so the bucket end does not
+// fall out of the range of ostime_t while the device is idle.
+static void runBudget (xref2osjob_t osjob) {
+    budgetRoll(os_getTime());
+    os_setTimedCallback(&BUDGET.job, BUDGET.bucketEnd, FUNC_ADDR(runBudget));
+}
+
+
+// Earliest time the budget allows a transmission with the given airtime.
+// A transmission exceeding the whole budget has to wait for an empty window.
+static ostime_t budgetAvail (ostime_t now, ostime_t airtime) {
+    if( BUDGET.bucketLen == 0 )
+        return now;
+    budgetRoll(now);
+    if( BUDGET.used == 0 || BUDGET.used + airtime <= BUDGET.budget )
+        return now;
+    u4_t need = (u4_t)airtime > BUDGET.budget ? BUDGET.used : BUDGET.used + airtime - BUDGET.budget;
+    // The bucket after the current one is the oldest and leaves first
+    ostime_t t = BUDGET.bucketEnd;
+    u1_t idx = BUDGET.cur;
+    for( u1_t i=1; i<LMIC_BUDGET_BUCKETS; i++, t += BUDGET.bucketLen ) {
+        if( ++idx == LMIC_BUDGET_BUCKETS )
+            idx = 0;
+        if( BUDGET.buckets[idx] >= need )
+            break;
+        need -= BUDGET.buckets[idx];
+    }
+    return t;
+}
+
+
+static void budgetUse (ostime_t now, ostime_t airtime) {
+    if( BUDGET.bucketLen == 0 )
+        return;
+    budgetRoll(now);
+    BUDGET.buckets[BUDGET.cur] += airtime;
+    BUDGET.used += airtime;
+}
+
+
+// Earliest time the budget allows the pending frame at datarate *dr. With
+// BUDGET_RAISEDR, a data frame that has to wait is sent right away at the
+// lowest higher datarate of the TX channel it fits with, if any.
+static ostime_t budgetTx (ostime_t now, bit_t jacc, dr_t* dr) {
+    int flen = LEN_JR;
+    if( !jacc ) {
+        bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
+        u1_t dlen = LMIC.pendTxLen;
+#if defined(ENABLE_TX_QUEUE)
+        if( LMIC.txqPend && LMIC.txCnt == 0 ) {
+            int best = txqBest(maxPayload(dataFrameLen(1, 0) - 5));
+            if( best >= 0 )
+                dlen = LMIC.txq[best].len;
+        }
+#endif // ENABLE_TX_QUEUE
+        // Options that do not fit are left for a later frame
+        flen = dataFrameLen(txdata, txdata ? dlen : 0);
+        int limit = maxFrameLen(LMIC.datarate);
+        if( limit > MAX_LEN_FRAME )
+            limit = MAX_LEN_FRAME;
+        if( flen > limit )
+            flen = limit;
+    }
+    ostime_t avail = budgetAvail(now, calcAirTime(setCr(updr2rps(*dr), (cr_t)LMIC.errcr), flen));
+    if( avail != now && !jacc && (BUDGET.policy & BUDGET_RAISEDR) != 0 ) {
+        for( u1_t d = *dr+1; d < DR_NONE; d++ ) {
+            if( flen <= maxFrameLen(d) && chnlSupportsDr(LMIC.txChnl, d) &&
+                budgetAvail(now, calcAirTime(setCr(updr2rps(d), (cr_t)LMIC.errcr), flen)) == now ) {
+                *dr = (dr_t)d;
+                return now;
+            }
+        }
+    }
+    return avail;
+}
+
+
+// Check whether new data can be accepted under the BUDGET_REJECT policy
+static bit_t budgetAccept (u1_t dlen) {
+    if( BUDGET.bucketLen == 0 || (BUDGET.policy & BUDGET_REJECT) == 0 )
+        return 1;
+    ostime_t now = os_getTime();
+    int flen = dataFrameLen(1, dlen);
+    dr_t dr = (dr_t)LMIC.datarate;
+    do {
+        // Options that do not fit are left for a later frame
+        int limit = maxFrameLen(dr);
+        if( limit > MAX_LEN_FRAME )
+            limit = MAX_LEN_FRAME;
+        if( OFF_DAT_OPTS+5+dlen <= limit &&
+            budgetAvail(now, calcAirTime(setCr(updr2rps(dr), (cr_t)LMIC.errcr), flen < limit ? flen : limit)) == now )
+            return 1;
+    } while( (BUDGET.policy & BUDGET_RAISEDR) != 0 && ++dr < DR_NONE && chnlSupportsDr(LMIC.txChnl, dr) );
+    return 0;
+}
+#endif // ENABLE_AIRTIME_BUDGET
+
+
 static void engineUpdate (void) {
 #if LMIC_DEBUG_LEVEL > 0
     printf("%lu: engineUpdate, opmode=0x%x\n", os_getTime(), LMIC.opmode);
@@ -2024,6 +3477,12 @@ static void engineUpdate (void) {
     // Check for ongoing state: scan or TX/RX transaction
     if( (LMIC.opmode & (OP_SCAN|OP_TXRXPEND|OP_SHUTDOWN)) != 0 )
         return;
+#if defined(ENABLE_CLASS_C)
+    // The radio is needed for whatever comes next, a received frame is
+    // processed first
+    if( !stopRxC() )
+        return;
+#endif // ENABLE_CLASS_C
 
 #if !defined(DISABLE_JOIN)
     if( LMIC.devaddr == 0 && (LMIC.opmode & OP_JOINING) == 0 ) {
@@ -2036,6 +3495,20 @@ static void engineUpdate (void) {
     ostime_t rxtime = 0;
     ostime_t txbeg  = 0;
 
+#if defined(ENABLE_TX_QUEUE)
+    // Queued messages are only dequeued when the frame is built, so a more
+    // urgent message queued while waiting for the duty cycle goes first.
+    if( (LMIC.opmode & OP_TXDATA) == 0 ) {
+        txqExpire(now);
+        if( LMIC.txqLen != 0 && txqBest(maxPayload(dataFrameLen(1, 0) - 5)) >= 0 ) {
+            LMIC.opmode |= OP_TXDATA;
+            LMIC.txqPend = 1;
+            if( (LMIC.opmode & OP_JOINING) == 0 )
+                LMIC.txCnt = 0;
+        }
+    }
+#endif // ENABLE_TX_QUEUE
+
 #if !defined(DISABLE_BEACONS)
     if( (LMIC.opmode & OP_TRACK) != 0 ) {
         // We are tracking a beacon
@@ -2058,6 +3531,13 @@ static void engineUpdate (void) {
         // Delayed TX or waiting for duty cycle?
         if( (LMIC.globalDutyRate != 0 || (LMIC.opmode & OP_RNDTX) != 0)  &&  (txbeg - LMIC.globalDutyAvail) < 0 )
             txbeg = LMIC.globalDutyAvail;
+#if defined(ENABLE_AIRTIME_BUDGET)
+        // Waiting for the airtime budget?
+        dr_t budgetDr = (dr_t)LMIC.datarate;
+        ostime_t budgetBeg = budgetTx(now, jacc, &budgetDr);
+        if( txbeg - budgetBeg < 0 )
+            txbeg = budgetBeg;
+#endif // ENABLE_AIRTIME_BUDGET
 #if !defined(DISABLE_BEACONS)
         // If we're tracking a beacon...
         // then make sure TX-RX transaction is complete before beacon
@@ -2075,6 +3555,9 @@ static void engineUpdate (void) {
             // We could send right now!
         txbeg = now;
             dr_t txdr = (dr_t)LMIC.datarate;
+#if defined(ENABLE_AIRTIME_BUDGET)
+            txdr = budgetDr;
+#endif // ENABLE_AIRTIME_BUDGET
 #if !defined(DISABLE_JOIN)
             if( jacc ) {
                 u1_t ftype;
@@ -2110,6 +3593,26 @@ static void engineUpdate (void) {
                     // App code might do some stuff after send unaware of RESET.
                     goto reset;
                 }
+#if defined(ENABLE_TX_QUEUE)
+                if( LMIC.txqPend && LMIC.txCnt == 0 ) {
+                    LMIC.txqPend = 0;
+                    if( !txqPop(now) ) {
+                        // All queued messages expired while waiting, or
+                        // no longer fit at the current datarate
+                        LMIC.opmode &= ~OP_TXDATA;
+                        engineUpdate();
+                        return;
+                    }
+                }
+#endif // ENABLE_TX_QUEUE
+                if( (LMIC.opmode & OP_TXDATA) != 0 && LMIC.pendTxLen > maxPayload(OFF_DAT_OPTS) ) {
+                    // The datarate was lowered after the payload was
+                    // accepted, e.g. by ADR or a retransmission.
+                    LMIC.opmode &= ~OP_TXDATA;
+                    LMIC.txCnt = 0;
+                    reportEvent(EV_TXCANCELED);
+                    return;
+                }
                 buildDataFrame();
                 LMIC.osjob.func = FUNC_ADDR(updataDone);
             }
@@ -2117,6 +3620,20 @@ static void engineUpdate (void) {
             LMIC.dndr   = txdr;  // carry TX datarate (can be != LMIC.datarate) over to txDone/setupRx1
             LMIC.opmode = (LMIC.opmode & ~(OP_POLL|OP_RNDTX)) | OP_TXRXPEND | OP_NEXTCHNL;
             updateTx(txbeg);
+#if defined(ENABLE_LINK_ADAPT)
+            // Power reduced by the link adaptation, join requests use full power
+            if( !jacc && LMIC.lnkMargin != 0 && LMIC.adrEnabled == 0 && LMIC.adrTxPow < LMIC.txpow )
+                LMIC.txpow = LMIC.adrTxPow;
+            LMIC.lnkTxDr  = txdr;
+            LMIC.lnkTxPow = LMIC.txpow;
+#endif // ENABLE_LINK_ADAPT
+#if defined(ENABLE_CHANNEL_STATS)
+            if( !jacc )
+                LMIC.chnlStats[LMIC.txChnl].txCnt += 1;
+#endif // ENABLE_CHANNEL_STATS
+#if defined(ENABLE_AIRTIME_BUDGET)
+            budgetUse(txbeg, calcAirTime(LMIC.rps, LMIC.dataLen));
+#endif // ENABLE_AIRTIME_BUDGET
             os_radio(RADIO_TX);
             return;
         }
@@ -2128,8 +3645,13 @@ static void engineUpdate (void) {
             txbeg += 1;  // TX delayed by one tick (insignificant amount of time)
     } else {
         // No TX pending - no scheduled RX
-        if( (LMIC.opmode & OP_TRACK) == 0 )
+        if( (LMIC.opmode & OP_TRACK) == 0 ) {
+#if defined(ENABLE_CLASS_C)
+            if( (LMIC.opmode & OP_CLASSC) != 0 && LMIC.devaddr != 0 )
+                startRxC(0);
+#endif // ENABLE_CLASS_C
             return;
+        }
     }
 
 #if !defined(DISABLE_BEACONS)
@@ -2138,13 +3660,14 @@ static void engineUpdate (void) {
 #if !defined(DISABLE_PING)
     if( (LMIC.opmode & OP_PINGINI) != 0 ) {
         // One more RX slot in this beacon period?
-        if( rxschedNext(&LMIC.ping, now+RX_RAMPUP) ) {
-            if( txbeg != 0  &&  (txbeg - LMIC.ping.rxtime) < 0 )
+        xref2rxsched_t rxsched = pingNext(now+RX_RAMPUP);
+        if( rxsched != (xref2rxsched_t)0 ) {
+            if( txbeg != 0  &&  (txbeg - rxsched->rxtime) < 0 )
                 goto txdelay;
-            LMIC.rxsyms  = LMIC.ping.rxsyms;
-            LMIC.rxtime  = LMIC.ping.rxtime;
-            LMIC.freq    = LMIC.ping.freq;
-            LMIC.rps     = dndr2rps(LMIC.ping.dr);
+            LMIC.rxsyms  = rxsched->rxsyms;
+            LMIC.rxtime  = rxsched->rxtime;
+            LMIC.freq    = rxsched->freq;
+            LMIC.rps     = dndr2rps(rxsched->dr);
             LMIC.dataLen = 0;
             ASSERT(LMIC.rxtime - now+RX_RAMPUP >= 0 );
             os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, FUNC_ADDR(startRxPing));
@@ -2174,6 +3697,12 @@ static void engineUpdate (void) {
                        e_.eui    = MAIN::CDEV->getEui(),
                        e_.info   = osticks2ms(txbeg-now),
                        e_.info2  = LMIC.seqnoUp-1));
+#if defined(ENABLE_CLASS_C)
+    if( (LMIC.opmode & OP_CLASSC) != 0 && LMIC.devaddr != 0 ) {
+        startRxC(txbeg-TX_RAMPUP);
+        return;
+    }
+#endif // ENABLE_CLASS_C
     os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
 }
 
@@ -2183,6 +3712,28 @@ void LMIC_setAdrMode (bit_t enabled) {
 }
 
 
+#if defined(ENABLE_LINK_ADAPT)
+//! \brief Let the device adapt datarate and TX power by itself while ADR
+//! is disabled. Downlink signal strength and the margins of link check
+//! answers are tracked over the last LMIC_LINK_WINDOW frames. The fastest
+//! datarate, and the lowest TX power down to LMIC_LINK_MINPOW on it, which
+//! keep the given margin for the weakest of them are used. The TX power
+//! set at the time of this call is the maximum. Downlink levels are
+//! reduced by the difference between LMIC_LINK_GWPOW and that power.
+//! \param margin required margin above the sensitivity in dB, 0 to turn
+//!    adaptation off and restore the maximum TX power.
+void LMIC_setLinkAdapt (u1_t margin) {
+    if( LMIC.lnkMargin == 0 )
+        LMIC.lnkMaxPow = LMIC.adrTxPow;
+    else if( margin == 0 )
+        LMIC.adrTxPow = LMIC.lnkMaxPow;
+    LMIC.lnkMargin = margin;
+    if( margin != 0 && LMIC.lnkCnt != 0 && LMIC.adrEnabled == 0 )
+        linkAdapt();
+}
+#endif // ENABLE_LINK_ADAPT
+
+
 //  Should we have/need an ext. API like this?
 void LMIC_setDrTxpow (dr_t dr, s1_t txpow) {
     setDrTxpow(DRCHG_SET, dr, txpow);
@@ -2191,7 +3742,13 @@ void LMIC_setDrTxpow (dr_t dr, s1_t txpow) {
 
 void LMIC_shutdown (void) {
     os_clearCallback(&LMIC.osjob);
+#if defined(ENABLE_TX_KEYSTREAM)
+    os_clearCallback(&LMIC.ksjob);
+#endif
     os_radio(RADIO_RST);
+#if defined(ENABLE_CLASS_C)
+    LMIC.rxcActive = 0;
+#endif
     LMIC.opmode |= OP_SHUTDOWN;
 }
 
@@ -2202,6 +3759,9 @@ void LMIC_reset (void) {
                        e_.info   = EV_RESET));
     os_radio(RADIO_RST);
     os_clearCallback(&LMIC.osjob);
+#if defined(ENABLE_TX_KEYSTREAM)
+    os_clearCallback(&LMIC.ksjob);
+#endif
 
     os_clearMem((xref2u1_t)&LMIC,SIZEOFEXPR(LMIC));
     LMIC.devaddr      =  0;
@@ -2240,6 +3800,13 @@ void LMIC_init (void) {
 void LMIC_clrTxData (void) {
     LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND|OP_POLL);
     LMIC.pendTxLen = 0;
+#if defined(ENABLE_TX_QUEUE)
+    LMIC.txqLen = 0;
+    LMIC.txqPend = 0;
+#endif
+#if defined(ENABLE_TX_INPLACE)
+    LMIC.txInplace = 0;
+#endif
     if( (LMIC.opmode & (OP_JOINING|OP_SCAN)) != 0 ) // do not interfere with JOINING
         return;
     os_clearCallback(&LMIC.osjob);
@@ -2250,16 +3817,31 @@ void LMIC_clrTxData (void) {
 
 void LMIC_setTxData (void) {
     LMIC.opmode |= OP_TXDATA;
+#if defined(ENABLE_TX_QUEUE)
+    LMIC.txqPend = 0;             // pendTxData now holds application data
+#endif
+#if defined(ENABLE_TX_INPLACE)
+    LMIC.txInplace = 0;
+#endif
     if( (LMIC.opmode & OP_JOINING) == 0 )
         LMIC.txCnt = 0;             // cancel any ongoing TX/RX retries
     engineUpdate();
 }
 
 
-//
+//! \brief Send a payload on the given port as soon as possible.
+//! \return 0 if the payload is scheduled for transmission, -2 if it is
+//!    too long for the current datarate, -3 if it is refused by the
+//!    airtime budget. If the datarate is lowered before the frame is
+//!    sent and the payload no longer fits, EV_TXCANCELED is reported
+//!    instead of EV_TXCOMPLETE.
 int LMIC_setTxData2 (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
-    if( dlen > SIZEOFEXPR(LMIC.pendTxData) )
+    if( dlen > maxPayload(OFF_DAT_OPTS) )
         return -2;
+#if defined(ENABLE_AIRTIME_BUDGET)
+    if( !budgetAccept(dlen) )
+        return -3;
+#endif // ENABLE_AIRTIME_BUDGET
     if( data != (xref2u1_t)0 )
         os_copyMem(LMIC.pendTxData, data, dlen);
     LMIC.pendTxConf = confirmed;
@@ -2270,6 +3852,121 @@ int LMIC_setTxData2 (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
 }
 
 
+#if defined(ENABLE_TX_QUEUE)
+//! \brief Add a message to the uplink queue. Messages are sent in order
+//! of decreasing priority, and in order of queueing for equal priority,
+//! as soon as channel availability and duty cycle permit.
+//! LMIC_clrTxData() also empties the queue.
+//! \param prio priority, higher values are sent first.
+//! \param lifetime number of ticks after which the message is dropped if
+//!    it was not sent yet, or 0 to never drop it.
+//! \return 0 if queued, -1 if the queue is full, -2 if the message is too
+//!    long for the current datarate (or too long once framed, see
+//!    LMIC_setTxFramer()), -3 if it is refused by the airtime budget (see
+//!    LMIC_setAirtimeBudget()).
+int LMIC_queueTxData (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed, u1_t prio, ostime_t lifetime) {
+    if( dlen > maxPayload(OFF_DAT_OPTS) )
+        return -2;
+    if( LMIC.txqLen >= LMIC_TX_QUEUE_SIZE )
+        return -1;
+    txqmsg_t* m = &LMIC.txq[LMIC.txqLen];
+#if defined(ENABLE_TX_AGGREGATE)
+    // Frame into the free queue entry to check the length, it is
+    // overwritten with the message below.
+    if( LMIC.txFramer != 0 && LMIC.txFramer(m->data, maxPayload(OFF_DAT_OPTS), data, dlen) == 0 )
+        return -2;
+#endif // ENABLE_TX_AGGREGATE
+#if defined(ENABLE_AIRTIME_BUDGET)
+    if( !budgetAccept(dlen) )
+        return -3;
+#endif // ENABLE_AIRTIME_BUDGET
+    LMIC.txqLen += 1;
+    os_copyMem(m->data, data, dlen);
+    m->len    = dlen;
+    m->port   = port;
+    m->prio   = prio;
+    m->flags  = (confirmed ? TXQ_CONFIRMED : 0) | (lifetime != 0 ? TXQ_EXPIRES : 0);
+    m->expiry = os_getTime() + lifetime;
+    engineUpdate();
+    return 0;
+}
+
+
+// Number of messages waiting in the uplink queue
+u1_t LMIC_queuedTxData (void) {
+    return LMIC.txqLen;
+}
+
+#if defined(ENABLE_TX_AGGREGATE)
+//! \brief Set the function used to combine queued messages into one
+//! payload. It is called with the space left in the payload and must
+//! write the given message in a form the receiver can split again (e.g.
+//! prefixed with its length), and return the number of bytes written, or
+//! 0 if it does not fit. A message that does not fit even on its own is
+//! refused by LMIC_queueTxData(). Messages queued before the framer was
+//! set, or that do not fit at the current datarate, stay queued until
+//! they fit or expire. Without a framer, each message is sent on its own.
+//! Must be called again after LMIC_reset().
+void LMIC_setTxFramer (txframer_t framer) {
+    LMIC.txFramer = framer;
+}
+#endif // ENABLE_TX_AGGREGATE
+#endif // ENABLE_TX_QUEUE
+
+
+#if defined(ENABLE_TX_INPLACE)
+//! \brief Get the payload area of the next uplink frame, so the
+//! application can write its payload there directly instead of passing
+//! it to LMIC_setTxData2(), which copies it twice. Room for the pending
+//! MAC options and the port is reserved already.
+//! The payload must be written and passed to LMIC_commitTxBuffer() before
+//! returning to the LMIC run loop. Only unconfirmed frames are supported,
+//! since the frame buffer is reused for reception after transmission.
+//! \param maxlen set to the maximum payload length at the current datarate.
+//! \return the payload area, or NULL if no frame can be prepared now
+//!    (no session, or data, a join or beacon tracking is pending, or class
+//!    C reception may overwrite the frame buffer at any time).
+xref2u1_t LMIC_getTxBuffer (u1_t* maxlen) {
+    if( LMIC.devaddr == 0 ||
+        (LMIC.opmode & (OP_SCAN|OP_TRACK|OP_JOINING|OP_REJOIN|OP_TXDATA|OP_POLL|OP_TXRXPEND|OP_SHUTDOWN|OP_CLASSC)) != 0 )
+        return (xref2u1_t)0;
+    u1_t opts[FCT_OPTLEN];
+    int end = OFF_DAT_OPTS + buildMacOpts(opts, FCT_OPTLEN, 0);
+    int limit = maxPayload(end);
+    *maxlen = limit > 0 ? limit : 0;
+    LMIC.txInplace = end;
+    return LMIC.frame+end+1;
+}
+
+
+//! \brief Send the payload written to the area returned by
+//! LMIC_getTxBuffer() as an unconfirmed frame.
+//! \return 0 if the frame is scheduled for transmission, -1 if there is no
+//!    prepared frame, -2 if the payload is too long, -3 if it is refused
+//!    by the airtime budget.
+int LMIC_commitTxBuffer (u1_t port, u1_t dlen) {
+    if( LMIC.txInplace == 0 || (LMIC.opmode & (OP_TXDATA|OP_TXRXPEND)) != 0 )
+        return -1;
+    if( dlen > maxPayload(LMIC.txInplace) )
+        return -2;
+#if defined(ENABLE_AIRTIME_BUDGET)
+    if( !budgetAccept(dlen) )
+        return -3;
+#endif // ENABLE_AIRTIME_BUDGET
+    LMIC.pendTxConf = 0;
+    LMIC.pendTxPort = port;
+    LMIC.pendTxLen  = dlen;
+    LMIC.opmode |= OP_TXDATA;
+#if defined(ENABLE_TX_QUEUE)
+    LMIC.txqPend = 0;
+#endif
+    LMIC.txCnt = 0;
+    engineUpdate();
+    return 0;
+}
+#endif // ENABLE_TX_INPLACE
+
+
 // Send a payload-less message to signal device is alive
 void LMIC_sendAlive (void) {
     LMIC.opmode |= OP_POLL;
@@ -2277,6 +3974,319 @@ void LMIC_sendAlive (void) {
 }
 
 
+// Apply the global duty cycle and beacon tracking to a TX that could
+// start at txbeg as far as the channels are concerned, like engineUpdate
+// does (minus the random delay after a beacon).
+static ostime_t txAvail (ostime_t now, ostime_t txbeg, bit_t jacc) {
+    if( (LMIC.globalDutyRate != 0 || (LMIC.opmode & OP_RNDTX) != 0)  &&  (txbeg - LMIC.globalDutyAvail) < 0 )
+        txbeg = LMIC.globalDutyAvail;
+#if !defined(DISABLE_BEACONS)
+    if( (LMIC.opmode & OP_TRACK) != 0 &&
+        txbeg + (jacc ? JOIN_GUARD_osticks : TXRX_GUARD_osticks) - (LMIC.bcnRxtime - RX_RAMPUP) > 0 )
+        txbeg = LMIC.bcnRxtime - RX_RAMPUP + BCN_RESERVE_osticks;
+#endif // !DISABLE_BEACONS
+    if( txbeg - now < 0 )
+        txbeg = now;
+    return txbeg;
+}
+
+//! \brief Determine the earliest time a data frame could start to be
+//! sent, as limited by the duty cycle and beacon tracking. A transmission
+//! or reception in progress is not taken into account.
+//! \param dlen payload length.
+//! \param dr datarate the frame would be sent with.
+//! \param txbeg set to the earliest start time of the transmission.
+//! \return 1 on success, 0 if no enabled channel supports the datarate
+//!    or the payload does not fit into a frame at this datarate.
+bit_t LMIC_nextTxTime (u1_t dlen, dr_t dr, ostime_t* txbeg) {
+    if( dr >= DR_NONE )
+        return 0;
+    int flen = dataFrameLen(dlen != 0, dlen);
+    if( flen > MAX_LEN_FRAME || flen > maxFrameLen(dr) || !chnlAvail(dr, txbeg) )
+        return 0;
+    ostime_t now = os_getTime();
+    *txbeg = txAvail(now, *txbeg, 0);
+#if defined(ENABLE_AIRTIME_BUDGET)
+    ostime_t avail = budgetAvail(now, calcAirTime(setCr(updr2rps(dr), (cr_t)LMIC.errcr), flen));
+    if( avail - *txbeg > 0 )
+        *txbeg = avail;
+#endif // ENABLE_AIRTIME_BUDGET
+    return 1;
+}
+
+#if defined(ENABLE_CHANNEL_STATS)
+//! \brief Get the link statistics of a channel, or NULL if the channel
+//! number is out of range. The statistics are cleared by LMIC_reset().
+chnlstat_t* LMIC_getChannelStats (u1_t channel) {
+    if( channel >= MAX_STAT_CHANNELS )
+        return (chnlstat_t*)0;
+    return &LMIC.chnlStats[channel];
+}
+
+//! \brief Clear the link statistics of all channels and stop avoiding
+//! failing channels, e.g. after the device has moved.
+void LMIC_clearChannelStats (void) {
+    os_clearMem(LMIC.chnlStats, sizeof(LMIC.chnlStats));
+    os_clearMem(LMIC.chnlBad, sizeof(LMIC.chnlBad));
+}
+#endif // ENABLE_CHANNEL_STATS
+
+//! \brief Check whether a pending transmission (data, poll or join) has
+//! to wait, e.g. for the duty cycle, instead of being sent right away.
+bit_t LMIC_isTxDeferred (void) {
+    if( (LMIC.opmode & OP_TXRXPEND) != 0 )
+        return 0;  // already under way
+    if( (LMIC.opmode & (OP_JOINING|OP_REJOIN|OP_TXDATA|OP_POLL)) == 0
+#if defined(ENABLE_TX_QUEUE)
+        && LMIC.txqLen == 0
+#endif // ENABLE_TX_QUEUE
+        )
+        return 0;  // nothing to send
+    if( (LMIC.opmode & (OP_SCAN|OP_SHUTDOWN)) != 0 )
+        return 1;
+    ostime_t now = os_getTime();
+    ostime_t txbeg = LMIC.txend;
+    if( (LMIC.opmode & OP_NEXTCHNL) != 0 )
+        chnlAvail((dr_t)LMIC.datarate, &txbeg);
+    bit_t jacc = (LMIC.opmode & (OP_JOINING|OP_REJOIN)) != 0;
+    txbeg = txAvail(now, txbeg, jacc);
+#if defined(ENABLE_AIRTIME_BUDGET)
+    dr_t dr = (dr_t)LMIC.datarate;
+    ostime_t avail = budgetTx(now, jacc, &dr);
+    if( avail - txbeg > 0 )
+        txbeg = avail;
+#endif // ENABLE_AIRTIME_BUDGET
+    return txbeg - (now + TX_RAMPUP) >= 0;
+}
+
+
+#if defined(ENABLE_AIRTIME_BUDGET)
+//! \brief Limit the total airtime of all transmissions, including joins,
+//! within a sliding window. The window is divided into
+//! LMIC_BUDGET_BUCKETS buckets, so transmissions leave the window in
+//! steps of one bucket. The airtime used so far is kept.
+//! \param window window length in seconds, or 0 to remove the limit.
+//! \param budget maximum airtime within the window in milliseconds.
+//! \param policy BUDGET_DEFER to wait until a frame fits the budget,
+//!    optionally combined with BUDGET_RAISEDR to rather send it right
+//!    away at a higher datarate of the channel if it fits there, and with
+//!    BUDGET_REJECT to refuse new data that does not fit at the moment.
+void LMIC_setAirtimeBudget (u4_t window, u4_t budget, u1_t policy) {
+    BUDGET.policy = policy;
+    BUDGET.budget = ms2osticks(budget);
+    ostime_t len = sec2osticks(window) / LMIC_BUDGET_BUCKETS;
+    if( window == 0 ) {
+        os_clearCallback(&BUDGET.job);
+        os_clearMem(BUDGET.buckets, sizeof(BUDGET.buckets));
+        BUDGET.used = 0;
+    } else if( BUDGET.bucketLen == 0 ) {
+        BUDGET.bucketEnd = os_getTime() + len;
+        os_setTimedCallback(&BUDGET.job, BUDGET.bucketEnd, FUNC_ADDR(runBudget));
+    }
+    BUDGET.bucketLen = window == 0 ? 0 : len;
+    // Reschedule a deferred transmission, but do not start joining
+    if( LMIC.devaddr != 0 || (LMIC.opmode & OP_JOINING) != 0 )
+        engineUpdate();
+}
+
+//! \brief Get the airtime left within the current window in milliseconds,
+//! or 0xFFFFFFFF if no budget is set.
+u4_t LMIC_remainingBudget (void) {
+    if( BUDGET.bucketLen == 0 )
+        return 0xFFFFFFFF;
+    budgetRoll(os_getTime());
+    return BUDGET.used >= BUDGET.budget ? 0 : osticks2ms(BUDGET.budget - BUDGET.used);
+}
+#endif // ENABLE_AIRTIME_BUDGET
+
+
+// MAC state snapshot, see LMIC_saveState(). The snapshot holds the part
+// of LMIC between the radio settings and the public frame data as is,
+// so it is only valid for the same build. Deadlines are stored relative
+// to the time of the snapshot.
+enum { STATE_VERSION = 1 };
+enum { STATE_HDR = 1+2+4 };   // version, fingerprint, txend
+#define STATE_BEG ((xref2u1_t)(&LMIC.osjob+1))
+#define STATE_END ((xref2u1_t)&LMIC.txCnt)
+#if defined(ENABLE_AIRTIME_BUDGET)
+#define STATE_BUDGET ((xref2u1_t)&BUDGET.bucketLen)
+#define STATE_BUDGET_LEN ((u2_t)((xref2u1_t)(&BUDGET+1) - STATE_BUDGET))
+#else
+#define STATE_BUDGET_LEN 0
+#endif // ENABLE_AIRTIME_BUDGET
+
+static u2_t stateLen (void) {
+    return STATE_HDR + (STATE_END - STATE_BEG) + STATE_BUDGET_LEN + 2;
+}
+
+// Identifies the layout of the snapshot.
+static u2_t stateFingerprint (void) {
+    u2_t layout[] = { sizeof(LMIC), STATE_END - STATE_BEG, STATE_BUDGET_LEN,
+#if defined(CFG_eu868)
+                      868,
+#elif defined(CFG_us915)
+                      915,
+#endif
+                      STATE_VERSION };
+    return os_crc16((xref2u1_t)layout, sizeof(layout));
+}
+
+// Store the time left until the deadline in field into the copy of
+// base at dst.
+static void putRel (xref2u1_t dst, xref2u1_t base, ostime_t* field, ostime_t now) {
+    ostime_t rel = *field - now;
+    if( rel < 0 )
+        rel = 0;
+    os_copyMem(dst + ((xref2u1_t)field - base), &rel, sizeof(rel));
+}
+
+// Convert a relative deadline back, taking the time spent off into account.
+static ostime_t rebase (ostime_t rel, ostime_t now, u4_t offMs) {
+    if( (u4_t)osticks2ms(rel) <= offMs )
+        return now;
+    return now + rel - ms2osticks(offMs);
+}
+
+//! \brief Get the size of the buffer needed by LMIC_saveState().
+u2_t LMIC_stateSize (void) {
+    return stateLen();
+}
+
+//! \brief Save the MAC state, so it can be restored with
+//! LMIC_restoreState() after the MCU has been powered off.
+//! The session, counters, channel plan, duty cycle and pending data are
+//! included, radio and beacon tracking state is not. The snapshot is only
+//! valid for the same build of the firmware.
+//! \param buf buffer receiving the snapshot.
+//! \param maxlen size of the buffer, see LMIC_stateSize().
+//! \return the length of the snapshot, or 0 if the buffer is too small or
+//!    the MAC is busy with a transmission or beacon tracking.
+u2_t LMIC_saveState (xref2u1_t buf, u2_t maxlen) {
+    u2_t len = stateLen();
+    if( maxlen < len || (LMIC.opmode & (OP_TXRXPEND|OP_SCAN|OP_TRACK)) != 0 )
+        return 0;
+    ostime_t now = os_getTime();
+    buf[0] = STATE_VERSION;
+    os_wlsbf2(buf+1, stateFingerprint());
+    putRel(buf+3, (xref2u1_t)&LMIC.txend, &LMIC.txend, now);
+
+    xref2u1_t p = buf + STATE_HDR;
+    os_copyMem(p, STATE_BEG, STATE_END - STATE_BEG);
+#if defined(CFG_eu868)
+    for( u1_t bi=0; bi<MAX_BANDS; bi++ )
+        putRel(p, STATE_BEG, &LMIC.bands[bi].avail, now);
+#endif
+    putRel(p, STATE_BEG, &LMIC.globalDutyAvail, now);
+#if defined(ENABLE_TX_QUEUE)
+    for( u1_t i=0; i<LMIC.txqLen; i++ )
+        putRel(p, STATE_BEG, &LMIC.txq[i].expiry, now);
+#endif // ENABLE_TX_QUEUE
+    p += STATE_END - STATE_BEG;
+
+#if defined(ENABLE_AIRTIME_BUDGET)
+    budgetRoll(now);
+    os_copyMem(p, STATE_BUDGET, STATE_BUDGET_LEN);
+    putRel(p, STATE_BUDGET, &BUDGET.bucketEnd, now);
+    p += STATE_BUDGET_LEN;
+#endif // ENABLE_AIRTIME_BUDGET
+
+    os_wlsbf2(p, os_crc16(buf, len-2));
+    return len;
+}
+
+//! \brief Restore the MAC state saved by LMIC_saveState().
+//! Call after LMIC_reset(). Handlers and framers registered by the
+//! application are kept. Deadlines such as the duty cycle limits are
+//! moved to the new time base.
+//! \param buf snapshot as returned by LMIC_saveState().
+//! \param len length of the snapshot.
+//! \param offMs time in milliseconds which passed since the snapshot
+//!    was taken, as far as known.
+//! \return 1 if the state was restored, 0 if the snapshot is not valid
+//!    for this build (LMIC is left unchanged).
+bit_t LMIC_restoreState (xref2u1_t buf, u2_t len, u4_t offMs) {
+    if( len != stateLen() || buf[0] != STATE_VERSION ||
+        os_rlsbf2(buf+1) != stateFingerprint() ||
+        os_crc16(buf, len-2) != os_rlsbf2(buf+len-2) )
+        return 0;
+    ostime_t now = os_getTime();
+    ostime_t rel;
+
+#if defined(ENABLE_RX_HANDLERS)
+    rxport_t handlers[LMIC_RX_HANDLERS];
+    u1_t handlerCnt = LMIC.rxHandlerCnt;
+    os_copyMem(handlers, LMIC.rxHandlers, sizeof(handlers));
+#endif // ENABLE_RX_HANDLERS
+#if defined(ENABLE_TX_AGGREGATE)
+    txframer_t framer = LMIC.txFramer;
+#endif // ENABLE_TX_AGGREGATE
+#if defined(ENABLE_TX_KEYSTREAM)
+    os_clearCallback(&LMIC.ksjob);
+#endif // ENABLE_TX_KEYSTREAM
+
+    os_copyMem(&rel, buf+3, sizeof(rel));
+    LMIC.txend = rebase(rel, now, offMs);
+    xref2u1_t p = buf + STATE_HDR;
+    os_copyMem(STATE_BEG, p, STATE_END - STATE_BEG);
+    p += STATE_END - STATE_BEG;
+#if defined(CFG_eu868)
+    for( u1_t bi=0; bi<MAX_BANDS; bi++ )
+        LMIC.bands[bi].avail = rebase(LMIC.bands[bi].avail, now, offMs);
+#endif
+    LMIC.globalDutyAvail = rebase(LMIC.globalDutyAvail, now, offMs);
+#if defined(ENABLE_TX_QUEUE)
+    for( u1_t i=0; i<LMIC.txqLen; i++ )
+        LMIC.txq[i].expiry = rebase(LMIC.txq[i].expiry, now, offMs);
+#endif // ENABLE_TX_QUEUE
+
+#if defined(ENABLE_RX_HANDLERS)
+    LMIC.rxHandlerCnt = handlerCnt;
+    os_copyMem(LMIC.rxHandlers, handlers, sizeof(handlers));
+#endif // ENABLE_RX_HANDLERS
+#if defined(ENABLE_TX_AGGREGATE)
+    LMIC.txFramer = framer;
+#endif // ENABLE_TX_AGGREGATE
+#if defined(ENABLE_TX_KEYSTREAM)
+    os_clearMem(&LMIC.ksjob, sizeof(LMIC.ksjob));
+    LMIC.ksValid = 0;
+#endif // ENABLE_TX_KEYSTREAM
+#if defined(ENABLE_CHANNEL_STATS)
+    // Failure times refer to the old time base, keep the counts only
+    os_clearMem(LMIC.chnlBad, sizeof(LMIC.chnlBad));
+#endif // ENABLE_CHANNEL_STATS
+#if !defined(DISABLE_BEACONS) && defined(ENABLE_TIMED_SCAN)
+    // The GPS time estimate refers to the old time base
+    LMIC.scanErr = 0;
+#endif // !DISABLE_BEACONS && ENABLE_TIMED_SCAN
+
+#if defined(ENABLE_AIRTIME_BUDGET)
+    os_copyMem(STATE_BUDGET, p, STATE_BUDGET_LEN);
+    if( BUDGET.bucketLen == 0 ) {
+        os_clearCallback(&BUDGET.job);
+    } else {
+        // Drop the buckets which have left the window while powered off
+        u4_t endMs = osticks2ms(BUDGET.bucketEnd);
+        u1_t n = 0;
+        while( endMs <= offMs && n < LMIC_BUDGET_BUCKETS ) {
+            budgetShift();
+            endMs += osticks2ms(BUDGET.bucketLen);
+            BUDGET.bucketEnd += BUDGET.bucketLen;
+            n++;
+        }
+        BUDGET.bucketEnd = n == LMIC_BUDGET_BUCKETS
+            ? now + BUDGET.bucketLen
+            : rebase(BUDGET.bucketEnd, now, offMs);
+        os_setTimedCallback(&BUDGET.job, BUDGET.bucketEnd, FUNC_ADDR(runBudget));
+    }
+#endif // ENABLE_AIRTIME_BUDGET
+
+    // Jobs are not part of the snapshot, the engine reschedules
+    // whatever is pending.
+    os_setCallback(&LMIC.osjob, FUNC_ADDR(runEngineUpdate));
+    return 1;
+}
+
+
 // Check if other networks are around.
 void LMIC_tryRejoin (void) {
     LMIC.opmode |= OP_REJOIN;
@@ -2320,6 +4330,62 @@ void LMIC_setSession (u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t
     DO_DEVDB(LMIC.seqnoDn, seqnoDn);
 }
 
+#if defined(ENABLE_MULTICAST)
+//! \brief Set up a multicast group. Frames sent to the group address are
+//! received during class C reception and in class B ping slots, and are
+//! reported like unicast frames with TXRX_MCAST set in LMIC.txrxFlags and
+//! the group in LMIC.rxGroup. Group ping slots are disabled.
+//! \param group index of the group, 0 to LMIC_MCAST_GROUPS-1.
+//! \param addr multicast address of the group, must not be 0.
+//! \param nwkKey the 16 byte network session key of the group.
+//! \param artKey the 16 byte application session key of the group.
+//! \param seqnoDn the next down stream seqno expected for the group.
+//! \return 1 if the group was set up, 0 if the arguments are not valid.
+bit_t LMIC_setMulticast (u1_t group, devaddr_t addr, xref2u1_t nwkKey, xref2u1_t artKey, u4_t seqnoDn) {
+    if( group >= LMIC_MCAST_GROUPS || addr == 0 )
+        return 0;
+    mcgroup_t* g = &LMIC.mcGroups[group];
+    g->addr = addr;
+    g->seqnoDn = seqnoDn;
+    os_copyMem(g->nwkKey, nwkKey, 16);
+    os_copyMem(g->artKey, artKey, 16);
+#if !defined(DISABLE_PING)
+    g->ping.intvExp = 0xFF;
+#endif
+    return 1;
+}
+
+//! \brief Stop receiving frames of a multicast group.
+void LMIC_clearMulticast (u1_t group) {
+    if( group < LMIC_MCAST_GROUPS )
+        os_clearMem((xref2u1_t)&LMIC.mcGroups[group], sizeof(mcgroup_t));
+}
+
+#if !defined(DISABLE_PING)
+//! \brief Open class B ping slots for a multicast group. The slots are
+//! scheduled like the ping slots of the device, starting with the next
+//! beacon, as long as the device itself is pingable.
+//! \param group index of a group set up with LMIC_setMulticast().
+//! \param intvExp ping period of 2^intvExp seconds (0..7), or 0xFF to
+//!    disable the group ping slots.
+//! \param freq frequency of the group ping slots.
+//! \param dr datarate of the group ping slots.
+//! \return 1 if the setting was changed, 0 if the group is not set up.
+bit_t LMIC_setMulticastPing (u1_t group, u1_t intvExp, u4_t freq, dr_t dr) {
+    if( group >= LMIC_MCAST_GROUPS || LMIC.mcGroups[group].addr == 0 )
+        return 0;
+    rxsched_t* rxsched = &LMIC.mcGroups[group].ping;
+    rxsched->intvExp = intvExp == 0xFF ? 0xFF : (intvExp & 0x7);
+    rxsched->freq = freq;
+    rxsched->dr = dr;
+    // No slots until the next beacon period
+    rxsched->slot = 128;
+    rxsched->rxtime = os_getTime();
+    return 1;
+}
+#endif // !DISABLE_PING
+#endif // ENABLE_MULTICAST
+
 // Enable/disable link check validation.
 // LMIC sets the ADRACKREQ bit in UP frames if there were no DN frames
 // for a while. It expects the network to provide a DN message to prove
@@ -2339,3 +4405,105 @@ void LMIC_setLinkCheckMode (bit_t enabled) {
 void LMIC_setClockError(u2_t error) {
     LMIC.clockError = error;
 }
+
+#if defined(ENABLE_EVENT_QUEUE)
+//! \brief Take the oldest event from the event queue. Use the flags,
+//! port and payload in the entry rather than LMIC.txrxFlags and the
+//! frame buffer, which describe the most recent transaction and might be
+//! newer than the event taken.
+//! \param ev set to the event. For EV_TXCOMPLETE and EV_RXCOMPLETE with
+//!    TXRX_PORT set, it holds a copy of the received payload.
+//! \return 0 if the queue is empty.
+bit_t LMIC_getEvent (evqent_t* ev) {
+    if( EVQ.count == 0 )
+        return 0;
+    *ev = EVQ.queue[EVQ.first];
+    EVQ.first = (EVQ.first + 1) % LMIC_EVENT_QUEUE_SIZE;
+    EVQ.count -= 1;
+    return 1;
+}
+
+// Number of events dropped so far because the event queue was full
+u2_t LMIC_lostEvents (void) {
+    return EVQ.lost;
+}
+#endif // ENABLE_EVENT_QUEUE
+
+#if defined(ENABLE_RX_HANDLERS)
+//! \brief Register a handler for downlink payloads on ports portLo to
+//! portHi (inclusive). When a downlink for one of these ports arrives,
+//! the handler is called with the decrypted payload in the frame buffer,
+//! before the corresponding event (EV_TXCOMPLETE or EV_RXCOMPLETE) is
+//! reported. rssi is passed in dBm and snr in dB, unlike LMIC.rssi and
+//! LMIC.snr. window is the TXRX_DNW1, TXRX_DNW2 or TXRX_PING flag, plus
+//! TXRX_MCAST for multicast frames. The payload is only valid during the
+//! call. If ranges overlap, the handler registered first is used. Must
+//! be called again after LMIC_reset().
+//! \return 0 if no more handlers can be registered.
+bit_t LMIC_registerRxHandler (u1_t portLo, u1_t portHi, rxhandler_t handler) {
+    if( LMIC.rxHandlerCnt >= LMIC_RX_HANDLERS )
+        return 0;
+    rxport_t* h = &LMIC.rxHandlers[LMIC.rxHandlerCnt++];
+    h->portLo  = portLo;
+    h->portHi  = portHi;
+    h->handler = handler;
+    return 1;
+}
+#endif // ENABLE_RX_HANDLERS
+
+#if defined(ENABLE_BATCH_CRYPTO)
+//! \brief Verify and decrypt a batch of captured data frames (up or down).
+//! This uses the same MIC and decryption code as the MAC layer, but does
+//! not touch the LMIC state, so it can be used by host side tools.
+//! All MICs are checked before any payload is decrypted, so consecutive
+//! frames with the same key do not need the key to be expanded again.
+//! \param frames the frames to process. The device address and direction
+//!    are taken from the frames themselves. For every frame `result`,
+//!    `dataBeg` and `dataLen` are set, and the payload of valid frames is
+//!    decrypted in place.
+//! \param count number of entries in `frames`.
+//! \return the number of frames with a valid MIC.
+int LMIC_decodeFrames (batchframe_t* frames, int count) {
+    int valid = 0;
+    for( int i=0; i<count; i++ ) {
+        batchframe_t* f = &frames[i];
+        xref2u1_t d = f->pdu;
+        int  dlen = f->len;
+
+        f->result = BATCH_INVALID;
+        f->dataBeg = f->dataLen = 0;
+        if( dlen < OFF_DAT_OPTS+4 )
+            continue;
+        u1_t ftype = d[OFF_DAT_HDR] & HDR_FTYPE;
+        if( (d[OFF_DAT_HDR] & HDR_MAJOR) != HDR_MAJOR_V1 ||
+            (ftype != HDR_FTYPE_DAUP && ftype != HDR_FTYPE_DADN &&
+             ftype != HDR_FTYPE_DCUP && ftype != HDR_FTYPE_DCDN) ||
+            OFF_DAT_OPTS + (d[OFF_DAT_FCT] & FCT_OPTLEN) > dlen-4 ||
+            os_rlsbf2(&d[OFF_DAT_SEQNO]) != (u2_t)f->seqno )
+            continue;
+        if( !aes_verifyMic(f->nwkKey, os_rlsbf4(&d[OFF_DAT_ADDR]), f->seqno,
+                           (ftype & HDR_FTYPE_DNFLAG) != 0, d, dlen-4) ) {
+            f->result = BATCH_BADMIC;
+            continue;
+        }
+        f->result = BATCH_OK;
+        valid++;
+    }
+    for( int i=0; i<count; i++ ) {
+        batchframe_t* f = &frames[i];
+        if( f->result != BATCH_OK )
+            continue;
+        xref2u1_t d = f->pdu;
+        int poff = OFF_DAT_OPTS + (d[OFF_DAT_FCT] & FCT_OPTLEN);
+        int pend = f->len-4;
+        if( pend <= poff )
+            continue;  // no port, no payload
+        u1_t port = d[poff++];
+        f->dataBeg = poff;
+        f->dataLen = pend-poff;
+        aes_cipher(port == 0 ? f->nwkKey : f->artKey, os_rlsbf4(&d[OFF_DAT_ADDR]), f->seqno,
+                   (d[OFF_DAT_HDR] & HDR_FTYPE_DNFLAG) != 0, d+poff, pend-poff);
+    }
+    return valid;
+}
+#endif // ENABLE_BATCH_CRYPTO
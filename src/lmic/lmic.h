@@ -27,7 +27,7 @@ extern "C"{
 #define LMIC_VERSION_MINOR 5
 #define LMIC_VERSION_BUILD 1431528305
 
-enum { MAX_FRAME_LEN      =  64 };   //!< Library cap on max frame length
+enum { MAX_FRAME_LEN      = MAX_LEN_FRAME };   //!< Library cap on max frame length
 enum { TXCONF_ATTEMPTS    =   8 };   //!< Transmit attempts for confirmed frames
 enum { MAX_MISSED_BCNS    =  20 };   // threshold for triggering rejoin requests
 enum { MAX_RXSYMS         = 100 };   // stop tracking beacon beyond this
@@ -72,6 +72,7 @@ enum { KEEP_TXPOW = -128 };
 
 #if !defined(DISABLE_PING)
 //! \internal
+enum { RXSCHED_SEGS = 8 };   // window widening steps per beacon period
 struct rxsched_t {
     u1_t     dr;
     u1_t     intvExp;   // 0..7
@@ -80,6 +81,11 @@ struct rxsched_t {
     ostime_t rxbase;
     ostime_t rxtime;    // start of next spot
     u4_t     freq;
+    ostime_t slotpos;   // offset of slot from rxbase in 1/128 osticks, less drift
+    u1_t     segsyms[RXSCHED_SEGS]; // rxsyms by distance of slot from beacon
+    u2_t     rnd;       // random slot offset of rndAddr in beacon period rndTime
+    u4_t     rndTime;
+    devaddr_t rndAddr;
 };
 TYPEDEF_xref2rxsched_t;  //!< \internal
 #endif // !DISABLE_PING
@@ -104,8 +110,101 @@ struct bcninfo_t {
     s4_t     lat;     //!< Lat field of last beacon (valid only if BCN_FULL set)
     s4_t     lon;     //!< Lon field of last beacon (valid only if BCN_FULL set)
 };
+#if defined(ENABLE_DRIFT_MODEL)
+#if !defined(LMIC_DRIFT_WINDOW)
+#define LMIC_DRIFT_WINDOW 8
+#endif
+#endif // ENABLE_DRIFT_MODEL
 #endif // !DISABLE_BEACONS
 
+#if defined(ENABLE_TX_QUEUE)
+#if !defined(LMIC_TX_QUEUE_SIZE)
+#define LMIC_TX_QUEUE_SIZE 4
+#endif
+enum { TXQ_CONFIRMED = 0x01,   // send as confirmed frame
+       TXQ_EXPIRES   = 0x02 }; // drop message when expiry has passed
+//! \internal
+struct txqmsg_t {
+    ostime_t expiry;    // deadline for TX start if TXQ_EXPIRES is set
+    u1_t     port;
+    u1_t     flags;     // TXQ_* flags
+    u1_t     prio;      // higher values are sent first
+    u1_t     len;
+    u1_t     data[MAX_LEN_PAYLOAD];
+};
+#if defined(ENABLE_TX_AGGREGATE)
+#if LMIC_TX_QUEUE_SIZE > 32
+#error ENABLE_TX_AGGREGATE supports at most 32 queue entries
+#endif
+//! Append one message to an aggregated payload, see LMIC_setTxFramer().
+typedef u1_t (*txframer_t) (xref2u1_t buf, u1_t avail, xref2cu1_t msg, u1_t len);
+#endif // ENABLE_TX_AGGREGATE
+#elif defined(ENABLE_TX_AGGREGATE)
+#error ENABLE_TX_AGGREGATE requires ENABLE_TX_QUEUE
+#endif // ENABLE_TX_QUEUE
+
+#if defined(ENABLE_LINK_ADAPT)
+#if !defined(LMIC_LINK_WINDOW)
+#define LMIC_LINK_WINDOW 8
+#endif
+#endif // ENABLE_LINK_ADAPT
+
+#if defined(ENABLE_RX_HANDLERS)
+#if !defined(LMIC_RX_HANDLERS)
+#define LMIC_RX_HANDLERS 4
+#endif
+//! Handler for downlink payloads, see LMIC_registerRxHandler(). rssi is
+//! in dBm and snr in dB.
+typedef void (*rxhandler_t) (u1_t port, xref2u1_t data, u1_t len, s1_t rssi, s1_t snr, u1_t window);
+//! \internal
+struct rxport_t {
+    u1_t        portLo;   // first port handled
+    u1_t        portHi;   // last port handled
+    rxhandler_t handler;
+};
+#endif // ENABLE_RX_HANDLERS
+
+#if defined(ENABLE_CHANNEL_STATS)
+#if defined(CFG_eu868)
+enum { MAX_STAT_CHANNELS = MAX_CHANNELS };
+#elif defined(CFG_us915)
+enum { MAX_STAT_CHANNELS = 72+MAX_XCHANNELS };
+#endif
+//! Link statistics of one channel, see LMIC_getChannelStats().
+struct chnlstat_t {
+    u2_t     txCnt;     //!< data frames sent
+    u2_t     okCnt;     //!< data frames answered by a downlink
+    s1_t     rssi;      //!< average RSSI of the answers in dBm
+    s1_t     snr;       //!< average SNR of the answers in dB
+    u1_t     fails;     //!< confirmed frames not answered in a row
+    ostime_t lastFail;  //!< time of the last unanswered confirmed frame
+};
+#endif // ENABLE_CHANNEL_STATS
+
+#if defined(ENABLE_MULTICAST)
+#if !defined(LMIC_MCAST_GROUPS)
+#define LMIC_MCAST_GROUPS 2
+#endif
+//! \internal
+struct mcgroup_t {
+    devaddr_t   addr;         // group address (0=unused)
+    u4_t        seqnoDn;      // next expected down stream seqno
+    u1_t        nwkKey[16];   // group network session key
+    u1_t        artKey[16];   // group application session key
+#if !defined(DISABLE_PING)
+    rxsched_t   ping;         // group ping slots (intvExp 0xFF=none)
+#endif
+};
+#endif // ENABLE_MULTICAST
+
+#if defined(ENABLE_JOIN_STRATEGY)
+#if defined(DISABLE_JOIN)
+#error ENABLE_JOIN_STRATEGY requires join support
+#endif
+//! Choose the datarate of a join attempt, see LMIC_setJoinStrategy().
+typedef dr_t (*joinstrategy_t) (u1_t attempt, dr_t lastDr);
+#endif // ENABLE_JOIN_STRATEGY
+
 // purpose of receive window - lmic_t.rxState
 enum { RADIO_RST=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3 };
 // Netid values /  lmic_t.netid
@@ -126,6 +225,7 @@ enum { OP_NONE     = 0x0000,
        OP_NEXTCHNL = 0x0800, // find a new channel
        OP_LINKDEAD = 0x1000, // link was reported as dead
        OP_TESTMODE = 0x2000, // developer test mode
+       OP_CLASSC   = 0x4000, // class C continuous reception enabled
 };
 // TX-RX transaction flags - report back to user
 enum { TXRX_ACK    = 0x80,   // confirmed UP frame was acked
@@ -133,14 +233,15 @@ enum { TXRX_ACK    = 0x80,   // confirmed UP frame was acked
        TXRX_NOPORT = 0x20,   // set if a frame with a port was RXed, clr if no frame/no port
        TXRX_PORT   = 0x10,   // set if a frame with a port was RXed, LMIC.frame[LMIC.dataBeg-1] => port
        TXRX_DNW1   = 0x01,   // received in 1st DN slot
-       TXRX_DNW2   = 0x02,   // received in 2dn DN slot
-       TXRX_PING   = 0x04 }; // received in a scheduled RX slot
+       TXRX_DNW2   = 0x02,   // received in 2dn DN slot (or class C reception)
+       TXRX_PING   = 0x04,   // received in a scheduled RX slot
+       TXRX_MCAST  = 0x08 }; // frame was sent to a multicast group, see LMIC.rxGroup
 // Event types for event callback
 enum _ev_t { EV_SCAN_TIMEOUT=1, EV_BEACON_FOUND,
              EV_BEACON_MISSED, EV_BEACON_TRACKED, EV_JOINING,
              EV_JOINED, EV_RFU1, EV_JOIN_FAILED, EV_REJOIN_FAILED,
              EV_TXCOMPLETE, EV_LOST_TSYNC, EV_RESET,
-             EV_RXCOMPLETE, EV_LINK_DEAD, EV_LINK_ALIVE };
+             EV_RXCOMPLETE, EV_LINK_DEAD, EV_LINK_ALIVE, EV_TXCANCELED };
 typedef enum _ev_t ev_t;
 
 enum {
@@ -159,6 +260,9 @@ struct lmic_t {
     u1_t        rxsyms;
     u1_t        dndr;
     s1_t        txpow;     // dBm
+#if defined(ENABLE_CLASS_C)
+    bit_t       rxcActive; // continuous class C reception running
+#endif
 
     osjob_t     osjob;
 
@@ -168,6 +272,8 @@ struct lmic_t {
     u4_t        channelFreq[MAX_CHANNELS];
     u2_t        channelDrMap[MAX_CHANNELS];
     u2_t        channelMap;
+    u2_t        bandChnlMap[MAX_BANDS];  // channels in each band
+    u2_t        drChnlMap[DR_NONE];      // channels supporting each datarate
 #elif defined(CFG_us915)
     u4_t        xchFreq[MAX_XCHANNELS];    // extra channel frequencies (if device is behind a repeater)
     u2_t        xchDrMap[MAX_XCHANNELS];   // extra channel datarate ranges  ---XXX: ditto
@@ -177,6 +283,10 @@ struct lmic_t {
     u1_t        txChnl;          // channel for next TX
     u1_t        globalDutyRate;  // max rate: 1/2^k
     ostime_t    globalDutyAvail; // time device can send again
+#if defined(ENABLE_CHANNEL_STATS)
+    chnlstat_t  chnlStats[MAX_STAT_CHANNELS];
+    u2_t        chnlBad[(MAX_STAT_CHANNELS+15)/16]; // channels avoided for failing
+#endif
 
     u4_t        netid;        // current network id (~0 - none)
     u2_t        opmode;
@@ -189,6 +299,18 @@ struct lmic_t {
     s2_t        drift;        // last measured drift
     s2_t        lastDriftDiff;
     s2_t        maxDriftDiff;
+#if defined(ENABLE_DRIFT_MODEL)
+    ostime_t    dmRef;        // txtime of the last received beacon
+    ostime_t    dmOff[LMIC_DRIFT_WINDOW]; // arrival of recent beacons, see driftSample()
+    u1_t        dmAge[LMIC_DRIFT_WINDOW]; // beacon periods before dmRef
+    u1_t        dmCnt;        // number of valid samples
+#endif
+#if defined(ENABLE_TIMED_SCAN)
+    ostime_t    scanRef;      // time at which the GPS time was about scanGps
+    u4_t        scanGps;      // GPS time estimate in seconds
+    u4_t        scanErr;      // max error of the estimate in ms (0=plain scan)
+    u1_t        scanSlice;    // part of the error range to scan next
+#endif
 #endif
 
     u2_t        clockError; // Inaccuracy in the clock. CLOCK_ERROR_MAX
@@ -198,6 +320,28 @@ struct lmic_t {
     u1_t        pendTxConf;   // confirmed data
     u1_t        pendTxLen;    // +0x80 = confirmed
     u1_t        pendTxData[MAX_LEN_PAYLOAD];
+#if defined(ENABLE_TX_QUEUE)
+    txqmsg_t    txq[LMIC_TX_QUEUE_SIZE]; // queued messages, oldest first
+    u1_t        txqLen;       // number of queued messages
+    bit_t       txqPend;      // OP_TXDATA set for queue, not yet dequeued
+#if defined(ENABLE_TX_AGGREGATE)
+    bit_t       txqAggr;      // pendTxData holds a framed message, more may be added
+    txframer_t  txFramer;     // frames messages for aggregation
+#endif
+#endif
+#if defined(ENABLE_RX_HANDLERS)
+    rxport_t    rxHandlers[LMIC_RX_HANDLERS];
+    u1_t        rxHandlerCnt;
+#endif
+#if defined(ENABLE_TX_INPLACE)
+    u1_t        txInplace;    // 0 or end of MAC options when payload is in frame
+#endif
+#if defined(ENABLE_TX_KEYSTREAM)
+    osjob_t     ksjob;        // job precomputing the next keystream
+    u4_t        ksSeqno;      // seqno the keystream was computed for
+    bit_t       ksValid;      // keystream matches current session
+    u1_t        keystream[MAX_LEN_PAYLOAD]; // artKey keystream for ksSeqno
+#endif
 
     u2_t        devNonce;     // last generated nonce
     u1_t        nwkKey[16];   // network session key
@@ -217,6 +361,15 @@ struct lmic_t {
     bit_t       devsAns;      // device status answer pending
     u1_t        adrEnabled;
     u1_t        moreData;     // NWK has more data pending
+#if defined(ENABLE_LINK_ADAPT)
+    s1_t        lnkLevel[LMIC_LINK_WINDOW]; // recent link levels, see linkSample()
+    u1_t        lnkCnt;       // number of valid levels
+    u1_t        lnkPos;       // next level to replace
+    u1_t        lnkMargin;    // required margin in dB (0=off)
+    s1_t        lnkMaxPow;    // TX power without reduction
+    u1_t        lnkTxDr;      // datarate of the last uplink, for MCMD_LCHK_ANS
+    s1_t        lnkTxPow;     // TX power of the last uplink
+#endif
 #if !defined(DISABLE_MCMD_DCAP_REQ)
     bit_t       dutyCapAns;   // have to ACK duty cycle settings
 #endif
@@ -241,10 +394,16 @@ struct lmic_t {
 #if !defined(DISABLE_PING)
     rxsched_t   ping;         // pingable setup
 #endif
+#if defined(ENABLE_MULTICAST)
+    mcgroup_t   mcGroups[LMIC_MCAST_GROUPS];
+#endif
 
     // Public part of MAC state
     u1_t        txCnt;
     u1_t        txrxFlags;  // transaction flags (TX-RX combo)
+#if defined(ENABLE_MULTICAST)
+    u1_t        rxGroup;    // multicast group of the frame if TXRX_MCAST is set
+#endif
     u1_t        dataBeg;    // 0 or start of data (dataBeg-1 is port)
     u1_t        dataLen;    // 0 no data or zero length data, >0 byte count of data
     u1_t        frame[MAX_LEN_FRAME];
@@ -265,6 +424,7 @@ DECLARE_LMIC; //!< \internal
 #if defined(CFG_eu868)
 enum { BAND_MILLI=0, BAND_CENTI=1, BAND_DECI=2, BAND_AUX=3 };
 bit_t LMIC_setupBand (u1_t bandidx, s1_t txpow, u2_t txcap);
+ostime_t LMIC_bandAvail (u1_t bandidx);
 #endif
 bit_t LMIC_setupChannel (u1_t channel, u4_t freq, u2_t drmap, s1_t band);
 void  LMIC_disableChannel (u1_t channel);
@@ -277,9 +437,16 @@ void  LMIC_selectSubBand (u1_t band);
 
 void  LMIC_setDrTxpow   (dr_t dr, s1_t txpow);  // set default/start DR/txpow
 void  LMIC_setAdrMode   (bit_t enabled);        // set ADR mode (if mobile turn off)
+#if defined(ENABLE_LINK_ADAPT)
+void  LMIC_setLinkAdapt (u1_t margin);          // device side DR/txpow adaptation if ADR is off
+#endif
 #if !defined(DISABLE_JOIN)
 bit_t LMIC_startJoining (void);
 #endif
+#if defined(ENABLE_JOIN_STRATEGY)
+void  LMIC_setJoinStrategy (joinstrategy_t strategy);
+void  LMIC_setJoinAirtime  (u4_t capMs);
+#endif
 
 void  LMIC_shutdown     (void);
 void  LMIC_init         (void);
@@ -288,9 +455,39 @@ void  LMIC_clrTxData    (void);
 void  LMIC_setTxData    (void);
 int   LMIC_setTxData2   (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed);
 void  LMIC_sendAlive    (void);
+bit_t LMIC_nextTxTime  (u1_t dlen, dr_t dr, ostime_t* txbeg);
+bit_t LMIC_isTxDeferred (void);
+#if defined(ENABLE_CHANNEL_STATS)
+chnlstat_t* LMIC_getChannelStats   (u1_t channel);
+void        LMIC_clearChannelStats (void);
+#endif
+#if defined(ENABLE_AIRTIME_BUDGET)
+//! Airtime budget policy flags, see LMIC_setAirtimeBudget()
+enum { BUDGET_DEFER=0x00, BUDGET_RAISEDR=0x01, BUDGET_REJECT=0x02 };
+void  LMIC_setAirtimeBudget (u4_t window, u4_t budget, u1_t policy);
+u4_t  LMIC_remainingBudget  (void);
+#endif
+#if defined(ENABLE_TX_INPLACE)
+xref2u1_t LMIC_getTxBuffer    (u1_t* maxlen);
+int       LMIC_commitTxBuffer (u1_t port, u1_t dlen);
+#endif
+#if defined(ENABLE_TX_QUEUE)
+int   LMIC_queueTxData  (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed, u1_t prio, ostime_t lifetime);
+u1_t  LMIC_queuedTxData (void);
+#if defined(ENABLE_TX_AGGREGATE)
+void  LMIC_setTxFramer  (txframer_t framer);
+#endif
+#endif
+
+#if defined(ENABLE_CLASS_C)
+bit_t LMIC_setClassC (bit_t enabled);
+#endif
 
 #if !defined(DISABLE_BEACONS)
 bit_t LMIC_enableTracking  (u1_t tryBcnInfo);
+#if defined(ENABLE_TIMED_SCAN)
+bit_t LMIC_enableTrackingAt (u4_t gpsTime, u4_t errMs);
+#endif
 void  LMIC_disableTracking (void);
 #endif
 
@@ -303,8 +500,56 @@ void  LMIC_tryRejoin     (void);
 #endif
 
 void LMIC_setSession (u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
+#if defined(ENABLE_SESSION_STORE)
+bit_t LMIC_restoreSession (void);
+#endif
+#if defined(ENABLE_MULTICAST)
+bit_t LMIC_setMulticast   (u1_t group, devaddr_t addr, xref2u1_t nwkKey, xref2u1_t artKey, u4_t seqnoDn);
+void  LMIC_clearMulticast (u1_t group);
+#if !defined(DISABLE_PING)
+bit_t LMIC_setMulticastPing (u1_t group, u1_t intvExp, u4_t freq, dr_t dr);
+#endif
+#endif // ENABLE_MULTICAST
+u2_t  LMIC_stateSize    (void);
+u2_t  LMIC_saveState    (xref2u1_t buf, u2_t maxlen);
+bit_t LMIC_restoreState (xref2u1_t buf, u2_t len, u4_t offMs);
 void LMIC_setLinkCheckMode (bit_t enabled);
 void LMIC_setClockError(u2_t error);
+#if defined(ENABLE_EVENT_QUEUE)
+//! An event taken from the event queue with LMIC_getEvent().
+struct evqent_t {
+    ostime_t time;       //!< Time the event was reported
+    ev_t     ev;         //!< The event
+    u1_t     txrxFlags;  //!< LMIC.txrxFlags when the event was reported
+    u1_t     port;       //!< Port of the received frame if TXRX_PORT is set
+    u1_t     dataLen;    //!< Length of the received payload
+    u1_t     data[MAX_LEN_PAYLOAD]; //!< Copy of the received payload
+};
+bit_t LMIC_getEvent (evqent_t* ev);
+u2_t  LMIC_lostEvents (void);
+#endif
+#if defined(ENABLE_RX_HANDLERS)
+bit_t LMIC_registerRxHandler (u1_t portLo, u1_t portHi, rxhandler_t handler);
+#endif
+
+#if defined(ENABLE_BATCH_CRYPTO)
+//! Result of decoding a frame with LMIC_decodeFrames().
+enum { BATCH_INVALID = -1,  //!< Not a well formed data frame
+       BATCH_BADMIC  =  0,  //!< MIC does not match
+       BATCH_OK      =  1 };//!< MIC verified, payload decrypted
+//! A data frame to be processed by LMIC_decodeFrames().
+struct batchframe_t {
+    const u1_t* nwkKey;   //!< Network session key (MIC and port 0 payload)
+    const u1_t* artKey;   //!< Application session key (payload)
+    u4_t        seqno;    //!< Full frame counter, low 16 bits must match FCnt
+    u1_t*       pdu;      //!< Complete frame including MIC, decrypted in place
+    u1_t        len;      //!< Length of the frame including MIC
+    s1_t        result;   //!< Out: BATCH_* result
+    u1_t        dataBeg;  //!< Out: 0 or start of payload (dataBeg-1 is port)
+    u1_t        dataLen;  //!< Out: payload length
+};
+int LMIC_decodeFrames (batchframe_t* frames, int count);
+#endif
 
 // Declare onEvent() function, to make sure any definition will have the
 // C conventions, even when in a C++ file.
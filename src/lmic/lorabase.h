@@ -37,7 +37,12 @@ enum { DR_PAGE_US915 = 0x10 };
 
 // Global maximum frame length
 enum { STD_PREAMBLE_LEN  =  8 };
-enum { MAX_LEN_FRAME     = 64 };
+#if !defined(LMIC_MAX_FRAME_LENGTH)
+#define LMIC_MAX_FRAME_LENGTH 64
+#elif LMIC_MAX_FRAME_LENGTH < 64 || LMIC_MAX_FRAME_LENGTH > 255
+#error LMIC_MAX_FRAME_LENGTH must be between 64 and 255
+#endif
+enum { MAX_LEN_FRAME     = LMIC_MAX_FRAME_LENGTH };
 enum { LEN_DEVNONCE      =  2 };
 enum { LEN_ARTNONCE      =  3 };
 enum { LEN_NETID         =  3 };
@@ -40,7 +40,20 @@ typedef const char* str_t;
 #include <string.h>
 #include "hal.h"
 #define EV(a,b,c) /**/
+#if defined(ENABLE_SESSION_STORE)
+// Session fields reported through DO_DEVDB, persisted by store.c
+enum { DEVDB_devaddr, DEVDB_netid, DEVDB_nwkkey, DEVDB_artkey, DEVDB_seqnoUp, DEVDB_seqnoDn,
+       DEVDB_devNonce, DEVDB_datarate, DEVDB_dn2Dr, DEVDB_dn2Freq, DEVDB_dutyCap,
+       DEVDB_pingIntvExp, DEVDB_pingFreq, DEVDB_pingDr, DEVDB_channelMap };
+void store_devdb (u1_t field);
+#define DO_DEVDB(field1,field2) store_devdb(DEVDB_ ## field2)
+#if defined(ENABLE_JOIN_STRATEGY)
+void store_join (u2_t nonce, u1_t dr);
+void store_loadJoin (u2_t* nonce, u1_t* dr);
+#endif
+#else
 #define DO_DEVDB(field1,field2) /**/
+#endif
 #if !defined(CFG_noassert)
 #define ASSERT(cond) if(!(cond)) hal_failed(__FILE__, __LINE__)
 #else
@@ -55,6 +68,12 @@ typedef      struct band_t band_t;
 typedef   struct chnldef_t chnldef_t;
 typedef   struct rxsched_t rxsched_t;
 typedef   struct bcninfo_t bcninfo_t;
+typedef struct batchframe_t batchframe_t;
+typedef    struct txqmsg_t txqmsg_t;
+typedef    struct rxport_t rxport_t;
+typedef  struct chnlstat_t chnlstat_t;
+typedef   struct mcgroup_t mcgroup_t;
+typedef    struct evqent_t evqent_t;
 typedef        const u1_t* xref2cu1_t;
 typedef              u1_t* xref2u1_t;
 #define TYPEDEF_xref2rps_t     typedef         rps_t* xref2rps_t
@@ -197,6 +216,15 @@ u2_t os_crc16 (xref2u1_t d, uint len);
 
 #endif // !HAS_os_calls
 
+#ifndef os_ctz2
+//! Index of the least significant set bit of a non-zero 16-bit value.
+#define os_ctz2(v) ((u1_t)__builtin_ctz(v))
+#endif
+#ifndef os_popcount2
+//! Number of set bits in a 16-bit value.
+#define os_popcount2(v) ((u1_t)__builtin_popcount(v))
+#endif
+
 // ======================================================================
 // Table support
 // These macros for defining a table of constants and retrieving values
@@ -270,6 +298,9 @@ u2_t os_crc16 (xref2u1_t d, uint len);
 #define AES_CTR       0x04
 #define AES_MICNOAUX  0x08
 #endif
+#if defined(ENABLE_HAL_AES) && defined(USE_ORIGINAL_AES)
+#error ENABLE_HAL_AES cannot be used with USE_ORIGINAL_AES
+#endif
 #ifndef AESkey  // if AESkey is defined as macro all other values must be too
 extern xref2u1_t AESkey;
 extern xref2u1_t AESaux;
@@ -452,6 +452,9 @@ static void txfsk () {
     // set the IRQ mapping DIO0=PacketSent DIO1=NOP DIO2=NOP
     writeReg(RegDioMapping1, MAP_DIO0_FSK_READY|MAP_DIO1_FSK_NOP|MAP_DIO2_FSK_TXNOP);
 
+    // the FSK FIFO holds 64 bytes, including the length byte
+    ASSERT(LMIC.dataLen < 64);
+
     // initialize the payload size and address pointers
     writeReg(FSKRegPayloadLength, LMIC.dataLen+1); // (insert length byte into payload))
 
@@ -557,8 +560,9 @@ static void rxlora (u1_t rxmode) {
     }
     // set LNA gain
     writeReg(RegLna, LNA_RX_GAIN);
-    // set max payload size
-    writeReg(LORARegPayloadMaxLength, 64);
+    // set max payload size and receive into the start of the FIFO
+    writeReg(LORARegPayloadMaxLength, MAX_LEN_FRAME);
+    writeReg(LORARegFifoRxBaseAddr, 0x00);
 #if !defined(DISABLE_INVERT_IQ_ON_RX)
     // use inverted I/Q signal (prevent mote-to-mote communication)
     writeReg(LORARegInvertIQ, readReg(LORARegInvertIQ)|(1<<6));
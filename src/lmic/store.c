@@ -0,0 +1,380 @@
+/*******************************************************************************
+ * Copyright (c) 2026 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Persistent session store, see ENABLE_SESSION_STORE in config.h.
+ *******************************************************************************/
+
+//! \file
+#include "lmic.h"
+
+#if defined(ENABLE_SESSION_STORE)
+
+#if !defined(LMIC_STORE_BASE)
+#define LMIC_STORE_BASE 0
+#endif
+#if !defined(LMIC_STORE_JOURNAL)
+#define LMIC_STORE_JOURNAL 32
+#endif
+
+// Storage layout, starting at LMIC_STORE_BASE:
+//  - two snapshot slots, written alternately
+//  - a journal of LMIC_STORE_JOURNAL entries of 4 bytes
+// A snapshot holds the session including the frame counters and a
+// generation number. Later counter updates are appended to the journal
+// as a 24 bit offset from the counter in the snapshot, with a tag byte
+// holding the counter kind and the generation of the snapshot. The tag
+// is written last and the tag of the following entry is cleared, so
+// the journal of the current snapshot ends at the first entry with a
+// different tag. When the journal is full or the session has changed,
+// a new snapshot is written to the other slot and the journal restarts.
+// With ENABLE_JOIN_STRATEGY, the next devNonce and the datarate of the
+// last successful join are journaled before each join request, so the
+// nonce never repeats after a reboot. Snapshots written while joining
+// keep the stored session, which stays valid until a join succeeds.
+
+enum { STORE_VERSION = 1 };
+enum { JRNL_UP = 0, JRNL_DN = 1, JRNL_JOIN = 2 };
+enum { JRNL_GENMASK = 0x3F, JRNL_ERASED = 0xFF };
+
+#if defined(CFG_eu868)
+enum { SNAP_CHNL = MAX_CHANNELS*(4+2) + 2 };
+#elif defined(CFG_us915)
+enum { SNAP_CHNL = (72+MAX_XCHANNELS+15)/16*2 + MAX_XCHANNELS*(4+2) };
+#endif
+#if !defined(DISABLE_PING)
+enum { SNAP_PING = 4+1 };
+#else
+enum { SNAP_PING = 0 };
+#endif
+#if defined(ENABLE_JOIN_STRATEGY)
+enum { SNAP_JOIN = 1 };
+#else
+enum { SNAP_JOIN = 0 };
+#endif
+enum {
+    SNAP_HDR  = 1+2,   // version, generation
+    SNAP_DATA = 4+4+16+16+4+4 + 1+4+1+1+1+1+2 + SNAP_PING + SNAP_JOIN + SNAP_CHNL,
+    SNAP_SEQNO = SNAP_HDR + 4+4+16+16,
+    SNAP_NONCE = SNAP_SEQNO + 4+4 + 1+4+1+1+1+1,
+    SNAP_SIZE = SNAP_HDR + SNAP_DATA + 2,  // with CRC
+    JRNL_ADDR = LMIC_STORE_BASE + 2*SNAP_SIZE
+};
+
+static struct {
+    u4_t base[3];   // counters in the current snapshot (0 for JRNL_JOIN)
+    u2_t gen;       // generation of the current snapshot
+    u1_t pos;       // next journal entry
+    u1_t dirty;     // session changed since the snapshot was written
+    u1_t init;      // gen has been read from the storage
+    u1_t busy;      // restoring, ignore field updates
+#if defined(ENABLE_JOIN_STRATEGY)
+    u2_t joinNonce; // next devNonce
+    u1_t joinDr;    // datarate of the last successful join, or DR_NONE
+    u1_t joinInit;  // join state has been read from the storage
+#endif
+} STORE;
+
+
+static u2_t slotAddr (u2_t gen) {
+    return LMIC_STORE_BASE + (gen & 1) * SNAP_SIZE;
+}
+
+// Read a snapshot slot, returns 0 if it does not hold a valid snapshot.
+static bit_t readSlot (u1_t slot, xref2u1_t buf) {
+    hal_store_read(slotAddr(slot), buf, SNAP_SIZE);
+    return buf[0] == STORE_VERSION &&
+        os_crc16(buf, SNAP_SIZE-2) == os_rlsbf2(buf+SNAP_SIZE-2);
+}
+
+// Load the newest valid snapshot into buf and set its generation.
+static bit_t loadSnapshot (xref2u1_t buf) {
+    bit_t valid0 = readSlot(0, buf);
+    u2_t gen0 = os_rlsbf2(buf+1);
+    bit_t valid1 = readSlot(1, buf);
+    u2_t gen1 = os_rlsbf2(buf+1);
+    STORE.init = 1;
+    if( valid1 && (!valid0 || (s2_t)(gen1 - gen0) > 0) ) {
+        STORE.gen = gen1;
+        return 1;
+    }
+    if( valid0 ) {
+        STORE.gen = gen0;
+        return readSlot(0, buf);
+    }
+    return 0;
+}
+
+// Apply the journal of the current snapshot in buf to the counters in ctr
+// and to the join state. Returns the position after the last entry.
+static u1_t readJournal (xref2u1_t buf, u4_t* ctr) {
+    ctr[JRNL_UP] = STORE.base[JRNL_UP] = os_rlsbf4(buf+SNAP_SEQNO);
+    ctr[JRNL_DN] = STORE.base[JRNL_DN] = os_rlsbf4(buf+SNAP_SEQNO+4);
+#if defined(ENABLE_JOIN_STRATEGY)
+    STORE.joinNonce = os_rlsbf2(buf+SNAP_NONCE);
+    STORE.joinDr    = buf[SNAP_SIZE-3];
+#endif
+    u1_t pos;
+    for( pos=0; pos<LMIC_STORE_JOURNAL; pos++ ) {
+        u1_t e[4];
+        hal_store_read(JRNL_ADDR + pos*4, e, 4);
+        if( e[0] == JRNL_ERASED || (e[0] & JRNL_GENMASK) != (STORE.gen & JRNL_GENMASK) )
+            break;
+        u1_t kind = e[0] >> 6;
+        if( kind <= JRNL_DN )
+            ctr[kind] = STORE.base[kind] + (e[1] | ((u4_t)e[2] << 8) | ((u4_t)e[3] << 16));
+#if defined(ENABLE_JOIN_STRATEGY)
+        if( kind == JRNL_JOIN ) {
+            STORE.joinNonce = e[1] | ((u2_t)e[2] << 8);
+            STORE.joinDr    = e[3];
+        }
+#endif
+    }
+    return pos;
+}
+
+#if defined(ENABLE_JOIN_STRATEGY)
+// Read the join state. Journaling continues after the entries found, so
+// a stored session is kept until it is replaced.
+static void loadJoin (void) {
+    u1_t buf[SNAP_SIZE];
+    u4_t ctr[2];
+    STORE.joinInit = 1;
+    if( loadSnapshot(buf) ) {
+        STORE.pos = readJournal(buf, ctr);
+    } else {
+        // Nothing stored, the first snapshot is written with the next update
+        STORE.joinNonce = LMIC.devNonce;
+        STORE.joinDr = DR_NONE;
+        STORE.dirty = 1;
+    }
+}
+
+// While joining, the LMIC holds no session. Copy the stored session with
+// the counters from its journal into buf instead, so it can still be
+// restored until a join succeeds. Returns 0 if nothing is stored.
+static bit_t copySession (xref2u1_t buf) {
+    u2_t nonce = STORE.joinNonce;
+    u1_t dr = STORE.joinDr;
+    u4_t ctr[2];
+    if( !loadSnapshot(buf) )
+        return 0;
+    readJournal(buf, ctr);
+    os_wlsbf4(buf+SNAP_SEQNO, ctr[JRNL_UP]);
+    os_wlsbf4(buf+SNAP_SEQNO+4, ctr[JRNL_DN]);
+    os_wlsbf2(buf+SNAP_NONCE, nonce);
+    buf[SNAP_SIZE-3] = dr;
+    STORE.joinNonce = nonce;
+    STORE.joinDr = dr;
+    return 1;
+}
+#endif // ENABLE_JOIN_STRATEGY
+
+static void clearEntry (u1_t pos) {
+    if( pos < LMIC_STORE_JOURNAL ) {
+        u1_t tag = JRNL_ERASED;
+        hal_store_write(JRNL_ADDR + pos*4, &tag, 1);
+    }
+}
+
+// Fill in the snapshot data from the LMIC.
+static void buildSnapshot (xref2u1_t buf) {
+    xref2u1_t p = buf + SNAP_HDR;
+    os_wlsbf4(p, LMIC.netid);             p += 4;
+    os_wlsbf4(p, LMIC.devaddr);           p += 4;
+    os_copyMem(p, LMIC.nwkKey, 16);       p += 16;
+    os_copyMem(p, LMIC.artKey, 16);       p += 16;
+    os_wlsbf4(p, LMIC.seqnoUp);           p += 4;
+    os_wlsbf4(p, LMIC.seqnoDn);           p += 4;
+    *p++ = LMIC.dn2Dr;
+    os_wlsbf4(p, LMIC.dn2Freq);           p += 4;
+    *p++ = LMIC.rxDelay;
+    *p++ = LMIC.datarate;
+    *p++ = LMIC.adrTxPow;
+    *p++ = LMIC.globalDutyRate;
+#if defined(ENABLE_JOIN_STRATEGY)
+    os_wlsbf2(p, STORE.joinNonce);        p += 2;
+#else
+    os_wlsbf2(p, LMIC.devNonce);          p += 2;
+#endif
+#if !defined(DISABLE_PING)
+    os_wlsbf4(p, LMIC.ping.freq);         p += 4;
+    *p++ = LMIC.ping.dr;
+#endif
+#if defined(CFG_eu868)
+    for( u1_t i=0; i<MAX_CHANNELS; i++ ) {
+        os_wlsbf4(p, LMIC.channelFreq[i]);  p += 4;
+        os_wlsbf2(p, LMIC.channelDrMap[i]); p += 2;
+    }
+    os_wlsbf2(p, LMIC.channelMap);        p += 2;
+#elif defined(CFG_us915)
+    for( u1_t i=0; i<(72+MAX_XCHANNELS+15)/16; i++ ) {
+        os_wlsbf2(p, LMIC.channelMap[i]);   p += 2;
+    }
+    for( u1_t i=0; i<MAX_XCHANNELS; i++ ) {
+        os_wlsbf4(p, LMIC.xchFreq[i]);      p += 4;
+        os_wlsbf2(p, LMIC.xchDrMap[i]);     p += 2;
+    }
+#endif
+#if defined(ENABLE_JOIN_STRATEGY)
+    *p++ = STORE.joinDr;
+#endif
+    ASSERT(p == buf+SNAP_SIZE-2);
+}
+
+static void writeSnapshot (void) {
+    u1_t buf[SNAP_SIZE];
+#if defined(ENABLE_JOIN_STRATEGY)
+    if( !STORE.joinInit )
+        loadJoin();
+    if( LMIC.devaddr == 0 && copySession(buf) ) {
+        // Only the join state changed
+    } else
+#endif
+    {
+        if( !STORE.init )
+            loadSnapshot(buf);
+        buildSnapshot(buf);
+    }
+    // The journal tag must not look like erased storage
+    if( (++STORE.gen & JRNL_GENMASK) == JRNL_GENMASK )
+        ++STORE.gen;
+    buf[0] = STORE_VERSION;
+    os_wlsbf2(buf+1, STORE.gen);
+    os_wlsbf2(buf+SNAP_SIZE-2, os_crc16(buf, SNAP_SIZE-2));
+    hal_store_write(slotAddr(STORE.gen), buf, SNAP_SIZE);
+
+    STORE.base[JRNL_UP] = os_rlsbf4(buf+SNAP_SEQNO);
+    STORE.base[JRNL_DN] = os_rlsbf4(buf+SNAP_SEQNO+4);
+    STORE.pos = 0;
+    STORE.dirty = 0;
+    // Entries of older snapshots are not read beyond the first one
+    clearEntry(0);
+}
+
+static void journal (u1_t kind, u4_t value) {
+    u4_t delta = value - STORE.base[kind];
+    if( STORE.dirty || !STORE.init || STORE.pos >= LMIC_STORE_JOURNAL || delta >= 0xFFFFFF ) {
+        writeSnapshot();
+        return;
+    }
+    u1_t e[4];
+    e[0] = (kind << 6) | (STORE.gen & JRNL_GENMASK);
+    e[1] = delta;
+    e[2] = delta >> 8;
+    e[3] = delta >> 16;
+    u2_t addr = JRNL_ADDR + STORE.pos*4;
+    hal_store_write(addr+1, e+1, 3);
+    hal_store_write(addr, e, 1);
+    clearEntry(++STORE.pos);
+}
+
+
+// Called through DO_DEVDB whenever a session field changes.
+void store_devdb (u1_t field) {
+    if( STORE.busy )
+        return;
+    switch( field ) {
+    case DEVDB_seqnoUp:
+        journal(JRNL_UP, LMIC.seqnoUp);
+        break;
+    case DEVDB_seqnoDn:
+        journal(JRNL_DN, LMIC.seqnoDn);
+        break;
+    default:
+#if defined(ENABLE_JOIN_STRATEGY)
+        // While joining only the join state is stored, see store_join()
+        if( LMIC.devaddr == 0 )
+            break;
+#endif
+        // Written with the next counter update
+        STORE.dirty = 1;
+        break;
+    }
+}
+
+
+#if defined(ENABLE_JOIN_STRATEGY)
+// Called by the join strategy before each join request and after a
+// successful join.
+void store_join (u2_t nonce, u1_t dr) {
+    if( !STORE.joinInit )
+        loadJoin();
+    STORE.joinNonce = nonce;
+    STORE.joinDr = dr;
+    journal(JRNL_JOIN, nonce | ((u4_t)dr << 16));
+}
+
+// Get the stored join state, or LMIC.devNonce and DR_NONE if none.
+void store_loadJoin (u2_t* nonce, u1_t* dr) {
+    if( !STORE.joinInit )
+        loadJoin();
+    *nonce = STORE.joinNonce;
+    *dr = STORE.joinDr;
+}
+#endif // ENABLE_JOIN_STRATEGY
+
+
+//! \brief Restore the session saved by the session store, instead of
+//! joining again or setting up the session with LMIC_setSession().
+//! Must be called after LMIC_reset().
+//! \return 1 if a session was restored, 0 if none was stored.
+bit_t LMIC_restoreSession (void) {
+    u1_t buf[SNAP_SIZE];
+    if( !loadSnapshot(buf) || os_rlsbf4(buf+3+4) == 0 )
+        return 0;
+
+    // Apply the counter updates from the journal
+    u4_t ctr[2];
+    STORE.pos = readJournal(buf, ctr);
+#if defined(ENABLE_JOIN_STRATEGY)
+    STORE.joinInit = 1;
+#endif
+
+    STORE.busy = 1;
+    xref2u1_t p = buf+3;
+    u4_t netid   = os_rlsbf4(p);  p += 4;
+    u4_t devaddr = os_rlsbf4(p);  p += 4;
+    LMIC_setSession(netid, devaddr, p, p+16);
+    p += 16+16+4+4;
+    LMIC.seqnoUp = ctr[JRNL_UP];
+    LMIC.seqnoDn = ctr[JRNL_DN];
+    LMIC.dn2Dr   = *p++;
+    LMIC.dn2Freq = os_rlsbf4(p);  p += 4;
+    LMIC.rxDelay = *p++;
+    u1_t dr = *p++;
+    LMIC_setDrTxpow(dr, (s1_t)*p++);
+    LMIC.globalDutyRate = *p++;
+    LMIC.devNonce = os_rlsbf2(p); p += 2;
+#if !defined(DISABLE_PING)
+    LMIC.ping.freq = os_rlsbf4(p); p += 4;
+    LMIC.ping.dr   = *p++;
+#endif
+#if defined(CFG_eu868)
+    for( u1_t i=0; i<MAX_CHANNELS; i++ ) {
+        u4_t freq = os_rlsbf4(p);
+        if( freq != 0 )
+            LMIC_setupChannel(i, freq & ~(u4_t)3, os_rlsbf2(p+4), freq & 3);
+        else
+            LMIC_disableChannel(i);
+        p += 4+2;
+    }
+    LMIC.channelMap = os_rlsbf2(p); p += 2;
+#elif defined(CFG_us915)
+    for( u1_t i=0; i<(72+MAX_XCHANNELS+15)/16; i++ ) {
+        LMIC.channelMap[i] = os_rlsbf2(p); p += 2;
+    }
+    for( u1_t i=0; i<MAX_XCHANNELS; i++ ) {
+        LMIC.xchFreq[i]  = os_rlsbf4(p);   p += 4;
+        LMIC.xchDrMap[i] = os_rlsbf2(p);   p += 2;
+    }
+#endif
+    STORE.busy = 0;
+    STORE.dirty = 0;
+    return 1;
+}
+
+#endif // ENABLE_SESSION_STORE